@@ -0,0 +1,108 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:arena.cc
+ * Bump allocated string pool backing node descriptions.
+ */
+
+#include "arena.h"
+
+using namespace std;
+
+StringPool::StringPool(size_t block_size)
+    : blockSize_(block_size),
+      used_(block_size),
+      cur_(0),
+      bytes_(0)
+{
+}
+
+StringPool::~StringPool()
+{
+    release();
+}
+
+/**
+ * Carve len bytes, anything bigger than a quarter block gets its own
+ * allocation so we do not waste the tail of the current block.
+ */
+char *
+StringPool::alloc(size_t len)
+{
+    bytes_ += len;
+    if (len > blockSize_ / 4) {
+        char *b = new char[len];
+        big_.push_back(b);
+        return b;
+    }
+
+    if (blocks_.empty() || used_ + len > blockSize_) {
+        if (!blocks_.empty() && cur_ + 1 < blocks_.size()) {
+            cur_++;
+        } else {
+            blocks_.push_back(new char[blockSize_]);
+            cur_ = blocks_.size() - 1;
+        }
+        used_ = 0;
+    }
+
+    char *p = blocks_[cur_] + used_;
+    used_ += len;
+    return p;
+}
+
+const char *
+StringPool::copy(const char *s, size_t len)
+{
+    char *p = alloc(len);
+    memcpy(p, s, len);
+    return p;
+}
+
+/**
+ * Forget everything handed out but keep the blocks for reuse.
+ */
+void
+StringPool::reset()
+{
+    for (size_t i = 0; i < big_.size(); ++i) {
+        delete [] big_[i];
+    }
+    big_.clear();
+    cur_ = 0;
+    used_ = (blocks_.empty() ? blockSize_ : 0);
+    bytes_ = 0;
+}
+
+void
+StringPool::release()
+{
+    reset();
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        delete [] blocks_[i];
+    }
+    blocks_.clear();
+    used_ = blockSize_;
+}
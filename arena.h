@@ -0,0 +1,120 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * Slab allocator for fixed size objects, objects are never freed one at a
+ * time, the whole arena goes away in release().
+ * Handed out objects are zero filled, same as the old new + memset.
+ */
+template <typename T>
+class SlabArena
+{
+public:
+    explicit SlabArena(size_t slab_count = 4096)
+        : slabCount_(slab_count),
+          used_(slab_count),
+          cur_(0),
+          total_(0)
+    {
+    }
+
+    virtual ~SlabArena()
+    {
+        release();
+    }
+
+    T *alloc()
+    {
+        if (used_ == slabCount_)
+            nextSlab();
+
+        T *t = &slabs_[cur_][used_++];
+        memset(t, 0, sizeof(T));
+        total_++;
+        return t;
+    }
+
+    /// Number of objects handed out since the last release()/reset().
+    size_t size() const { return total_; }
+
+    /// Bytes held by the arena.
+    size_t capacity() const { return slabs_.size() * slabCount_ * sizeof(T); }
+
+    /// Keep the slabs around for the next round of alloc().
+    void reset()
+    {
+        cur_ = 0;
+        used_ = (slabs_.empty() ? slabCount_ : 0);
+        total_ = 0;
+    }
+
+    void release()
+    {
+        for (size_t i = 0; i < slabs_.size(); ++i) {
+            delete [] slabs_[i];
+        }
+        slabs_.clear();
+        cur_ = 0;
+        used_ = slabCount_;
+        total_ = 0;
+    }
+
+private:
+    SlabArena(const SlabArena&);            /// no copies.
+    SlabArena& operator=(const SlabArena&);
+
+    void nextSlab()
+    {
+        if (!slabs_.empty() && cur_ + 1 < slabs_.size()) {
+            cur_++;                          /// reuse after reset().
+        } else {
+            slabs_.push_back(new T[slabCount_]);
+            cur_ = slabs_.size() - 1;
+        }
+        used_ = 0;
+    }
+
+    vector<T *> slabs_;
+    size_t slabCount_;            /// objects per slab
+    size_t used_;                 /// objects used in slabs_[cur_]
+    size_t cur_;                  /// slab we are carving from
+    size_t total_;
+};
+
+/**
+ * Bump allocator for descriptions, every copy takes exactly its length.
+ * Strings are not NUL terminated, node_t carries the length.
+ */
+class StringPool
+{
+public:
+    explicit StringPool(size_t block_size = 64 * 1024);
+    virtual ~StringPool();
+
+    const char *copy(const char *s, size_t len);
+    char *alloc(size_t len);
+
+    size_t size() const { return bytes_; }   /// bytes handed out.
+    void reset();
+    void release();
+
+private:
+    StringPool(const StringPool&);          /// no copies.
+    StringPool& operator=(const StringPool&);
+
+    vector<char *> blocks_;
+    vector<char *> big_;          /// strings that did not fit a block.
+    size_t blockSize_;
+    size_t used_;                 /// bytes used in blocks_[cur_]
+    size_t cur_;
+    size_t bytes_;
+};
+
+#endif
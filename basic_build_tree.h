@@ -0,0 +1,1978 @@
+// -*- C++ -*-
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "decode_errors.h"
+#include "decode_stats.h"
+#include "decompress.h"
+#include "descr_source.h"
+#include "flat_index.h"
+#include "mapped_file.h"
+#include "out_writer.h"
+#include "parallel_traverse.h"
+#include "read_ahead.h"
+#include "simd_scan.h"
+#include "traverse.h"
+using namespace std;
+
+#ifndef BASIC_BUILD_TREE_H
+#define BASIC_BUILD_TREE_H
+
+/**
+ * The decoder over any id width and payload:
+ *   BasicBuildTree<int64_t, text_payload> bt(fname);   // 64 bit ids
+ *   BasicBuildTree<int, value_payload<double> > vt(fname);
+ *   BasicBuildTree<int, no_payload> tt(fname);         // topology only
+ *   BasicBuildTree<int, offset_payload> ot(fname);     // descr on demand
+ * Parse and stitch are instantiated per Id and Payload, nothing is
+ * looked up at run time. BuildTree (build_tree.h) is the <int,
+ * text_payload> one with parallel decode, snapshots, queries, updates
+ * and compact copies on top.
+ *
+ * A payload is mixed into the node and tells the decoder:
+ *   present()    a record, not just a child reference (placeholder)
+ *   idCount()    how many of the leading numbers of a line are ids
+ *   parse<Id>()  take the rest of the line, false if malformed
+ *   keep()       copy out of a line that is about to go away (feed())
+ *   locate()     where the line starts in the file
+ *   print<Id>()  what printBFS()/printDFS() write per node
+ *   describe()   the same for diagnostics
+ * and two constants:
+ *   keepsMapping the payload points into the MMAP mapping
+ *   readsSource  print() needs the file again, see DescrSource
+ */
+
+enum class Status : std::int8_t
+{
+    NONE = 0,         /// invalid
+    NODE_WAIT = 1,    /// node is waiting.
+    NONNODE_WAIT = 2, /// non node is waiting.
+    FILLED = 3        /// Found a line with this node_id
+};
+
+enum class InputMode : std::int8_t
+{
+    STREAM = 0,       /// fstream + getline, one copy per line.
+    MMAP = 1,         /// map the file and tokenize lines in place.
+    ASYNC = 2         /// blocks read ahead into feed(), see read_ahead.h
+};
+
+const uint64_t maxFSize = 100*1024*1024;     /// in Bytes, 100Mb default
+const size_t maxLineSize = 1024;             /// in Char count, default
+const size_t largeReadSize = 1024 * 1024;    /// decodeLarge() read size
+const unsigned int readAheadDepth = 4;       /// decodeAsync() reads out
+const size_t mappedDropSize = 8 * 1024 * 1024; /// see decodeMapped()
+
+/// "<id> ", what a folded leaf id looks like in a description.
+inline int
+formatIdPrefix(char *buf, size_t size, long long id)
+{
+    return snprintf(buf, size, "%lld ", id);
+}
+
+/// Decimal without snprintf(), for the printers.
+inline void
+appendNumber(BufferedWriter& out, unsigned long long v, bool neg = false)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (neg)
+        *--p = '-';
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+inline void
+appendNumber(BufferedWriter& out, long long v)
+{
+    appendNumber(out, (v < 0 ? 0ULL - (unsigned long long)v : v), v < 0);
+}
+
+/**
+ * Free text after the ids, the original format. Points into the mapped
+ * file or the line when it can, copies into the pool otherwise.
+ */
+struct text_payload
+{
+    static const bool keepsMapping = true;
+    static const bool readsSource = false;
+
+    const char* descr_;
+    unsigned int dlen_;           /// descr_ need not be NUL terminated.
+
+    bool present() const { return descr_ != NULL; }
+
+    /// Complete trees read "<id> <leaf id> text" as one description.
+    static unsigned int idCount(const line_head_t& h, const char *end,
+                                bool complete_tree)
+    {
+        if (complete_tree && h.count_ == 2 && h.rest_ < end)
+            return 1;
+        return h.count_;
+    }
+
+    template <typename Id>
+    bool parse(const line_head_t& h, unsigned int ids, const char *end,
+               StringPool& descrs)
+    {
+        const char *descr = h.rest_;
+        if (ids < h.count_) {
+            // fold the leaf id into the description.
+            const char *left_tok = h.toks_[1];
+            char prefix[24];
+            int plen = formatIdPrefix(prefix, sizeof(prefix),
+                                      (Id)h.vals_[1]);
+            if (descr - left_tok == plen &&
+                memcmp(left_tok, prefix, plen) == 0) {
+                descr = left_tok;
+            } else {
+                size_t rest = end - descr;
+                char *buf = descrs.alloc(plen + rest);
+                memcpy(buf, prefix, plen);
+                memcpy(buf + plen, descr, rest);
+                descr_ = buf;
+                dlen_ = plen + rest;
+                return true;
+            }
+        }
+
+        descr_ = (descr < end ? descr : "");
+        dlen_ = (descr < end ? end - descr : 0);
+        return true;
+    }
+
+    void keep(const char *line, size_t len, StringPool& descrs)
+    {
+        if (descr_ >= line && descr_ < line + len)
+            descr_ = descrs.copy(descr_, dlen_);
+    }
+
+    void locate(uint64_t, size_t) {}
+
+    template <typename Id>
+    void print(BufferedWriter& out, Id, const DescrSource *) const
+    {
+        out.append(descr_, dlen_);
+    }
+
+    void describe(ostream& os) const
+    {
+        if (descr_)
+            os.write(descr_, dlen_);
+    }
+};
+
+/**
+ * Topology only, the text after the ids is skipped and the node prints
+ * as its id. Ids are read exactly as for text_payload so both decode
+ * the same tree.
+ */
+struct no_payload
+{
+    static const bool keepsMapping = false;
+    static const bool readsSource = false;
+
+    bool set_;                    /// a record, not just a child reference
+
+    bool present() const { return set_; }
+
+    static unsigned int idCount(const line_head_t& h, const char *end,
+                                bool complete_tree)
+    {
+        return text_payload::idCount(h, end, complete_tree);
+    }
+
+    template <typename Id>
+    bool parse(const line_head_t&, unsigned int, const char *, StringPool&)
+    {
+        set_ = true;
+        return true;
+    }
+
+    void keep(const char *, size_t, StringPool&) {}
+    void locate(uint64_t, size_t) {}
+
+    template <typename Id>
+    void print(BufferedWriter& out, Id id, const DescrSource *) const
+    {
+        appendNumber(out, (long long)id);
+    }
+
+    void describe(ostream& os) const { os << "(record)"; }
+};
+
+/// strtoll()/strtoull()/strtod() on a NUL terminated token, all of it
+/// has to be used and the value has to fit T.
+template <typename T>
+bool
+parseNumber(const char *s, T *val)
+{
+    char *stop = NULL;
+    errno = 0;
+    if (std::is_floating_point<T>::value) {
+        double d = strtod(s, &stop);
+        *val = (T)d;
+    } else if (std::is_signed<T>::value) {
+        long long v = strtoll(s, &stop, 10);
+        if (v < (long long)numeric_limits<T>::min() ||
+            v > (long long)numeric_limits<T>::max())
+            return false;
+        *val = (T)v;
+    } else {
+        if (*s == '-')
+            return false;
+        unsigned long long v = strtoull(s, &stop, 10);
+        if (v > (unsigned long long)numeric_limits<T>::max())
+            return false;
+        *val = (T)v;
+    }
+    return (errno == 0 && stop != s && *stop == '\0');
+}
+
+/**
+ * One number per record, the last token of "<id> [<left> [<right>]]
+ * <value>", parsed once here instead of kept as text.
+ */
+template <typename T>
+struct value_payload
+{
+    static const bool keepsMapping = false;
+    static const bool readsSource = false;
+
+    T value_;
+    bool set_;
+
+    bool present() const { return set_; }
+
+    static unsigned int idCount(const line_head_t& h, const char *end,
+                                bool)
+    {
+        // a value that looks like a number was scanned as one.
+        return (h.rest_ < end ? h.count_ : h.count_ - 1);
+    }
+
+    template <typename Id>
+    bool parse(const line_head_t& h, unsigned int ids, const char *end,
+               StringPool&)
+    {
+        const char *p = (ids < h.count_ ? h.toks_[ids] : h.rest_);
+        const char *q = p;
+        while (q < end && *q != ' ')
+            q++;
+        for (const char *r = q; r < end; ++r) {
+            if (*r != ' ')
+                return false;     /// one token only
+        }
+
+        char buf[64];
+        size_t len = q - p;
+        if (len == 0 || len >= sizeof(buf))
+            return false;
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+        if (!parseNumber(buf, &value_))
+            return false;
+        set_ = true;
+        return true;
+    }
+
+    void keep(const char *, size_t, StringPool&) {}
+    void locate(uint64_t, size_t) {}
+
+    template <typename Id>
+    void print(BufferedWriter& out, Id, const DescrSource *) const
+    {
+        if (std::is_floating_point<T>::value) {
+            char buf[64];
+            out.append(buf, snprintf(buf, sizeof(buf), "%.*g",
+                                     numeric_limits<T>::max_digits10,
+                                     (double)value_));
+        } else if (std::is_signed<T>::value) {
+            appendNumber(out, (long long)value_);
+        } else {
+            appendNumber(out, (unsigned long long)value_);
+        }
+    }
+
+    void describe(ostream& os) const { os << value_; }
+};
+
+/**
+ * Topology first: only where the description sits in the file is kept
+ * and print() reads it back through a DescrSource, byte for byte what
+ * text_payload would print. For jobs after the shape (depth, LCA)
+ * that look at a description now and then, the tree holds no text.
+ */
+struct offset_payload
+{
+    static const bool keepsMapping = false;
+    static const bool readsSource = true;
+
+    // 12 bytes, a node with int ids is 32 like one with no payload
+    // plus 8, offsets go up to 2^47.
+    uint32_t offLo_;              /// in the file once locate() ran
+    uint32_t len_;
+    uint32_t offHi_ : 15;
+    uint32_t set_ : 1;
+    uint32_t fold_ : 16;          /// > 0: leaf id to rewrite, see print()
+
+    bool present() const { return set_; }
+    uint64_t offset() const { return ((uint64_t)offHi_ << 32) | offLo_; }
+
+    static unsigned int idCount(const line_head_t& h, const char *end,
+                                bool complete_tree)
+    {
+        return text_payload::idCount(h, end, complete_tree);
+    }
+
+    template <typename Id>
+    bool parse(const line_head_t& h, unsigned int ids, const char *end,
+               StringPool&)
+    {
+        const char *descr = h.rest_;
+        fold_ = 0;
+        if (ids < h.count_) {
+            // the folded leaf id stays in the file as written, print()
+            // spells it the way text_payload does when they differ.
+            const char *left_tok = h.toks_[1];
+            char prefix[24];
+            int plen = formatIdPrefix(prefix, sizeof(prefix),
+                                      (Id)h.vals_[1]);
+            if (descr - left_tok != plen ||
+                memcmp(left_tok, prefix, plen) != 0) {
+                if (descr - left_tok > numeric_limits<uint16_t>::max())
+                    return false;
+                fold_ = descr - left_tok;
+            }
+            descr = left_tok;
+        }
+
+        if (descr < end && (uint64_t)(end - descr) >
+            numeric_limits<uint32_t>::max())
+            return false;
+        len_ = (descr < end ? end - descr : 0);
+        set_ = true;
+        return true;
+    }
+
+    void keep(const char *, size_t, StringPool&) {}
+
+    /// Descriptions run to the end of the line.
+    void locate(uint64_t line_off, size_t line_len)
+    {
+        uint64_t off = line_off + line_len - len_;
+        offLo_ = (uint32_t)off;
+        offHi_ = (uint32_t)(off >> 32);
+    }
+
+    template <typename Id>
+    void print(BufferedWriter& out, Id, const DescrSource *src) const
+    {
+        const char *p = (set_ && src ? src->at(offset(), len_) : NULL);
+        if (!p)
+            return;
+        if (fold_ == 0) {
+            out.append(p, len_);
+            return;
+        }
+
+        line_head_t h;
+        scanHead(p, fold_, &h);
+        char prefix[24];
+        out.append(prefix, formatIdPrefix(prefix, sizeof(prefix),
+                                          (Id)h.vals_[0]));
+        out.append(p + fold_, len_ - fold_);
+    }
+
+    void describe(ostream& os) const
+    {
+        os << "(at " << offset() << ", " << len_ << " bytes)";
+    }
+};
+
+/**
+ * Node of a BasicBuildTree, the payload's fields sit in front.
+ */
+template <typename Id, typename Payload>
+struct basic_node : Payload
+{
+    Id id_;
+    basic_node *left_;
+    basic_node *right_;
+};
+
+/// Which node struct a tree uses, BuildTree keeps its own struct node.
+template <typename Id, typename Payload>
+struct node_type
+{
+    typedef basic_node<Id, Payload> type;
+};
+
+template <typename N>
+struct basic_href
+{
+    N** nodePtr_;
+    Status status_;
+};
+
+/**
+ * Alloc hands out zero filled N, see SlabArena for the interface
+ * (alloc(), size(), reset(), release()).
+ */
+template <typename Id, typename Payload,
+          typename Alloc = SlabArena<typename node_type<Id, Payload>::type> >
+class BasicBuildTree
+{
+public:
+    typedef typename node_type<Id, Payload>::type Node;
+    typedef basic_href<Node> Ref;
+    typedef FlatIndex<Ref, Id> Index;
+
+    BasicBuildTree();
+    BasicBuildTree(const string& fname, bool complete_tree=true,
+                   bool dup_ids=false);
+    virtual ~BasicBuildTree();
+
+    int decodeFile();
+    void printBFS() const;        /// to stdout
+    void printDFS() const;
+    void printBFS(OutputSink& sink) const;
+    void printDFS(OutputSink& sink) const;
+    const Node *root() const { return decodedTree_; }
+
+    /// What the printers write for n, read back from the file for
+    /// payloads that left it there (readsSource).
+    int materialize(const Node *n, string& out) const;
+    void releaseSource();         /// unmap it again until the next print
+
+    /// Push style decode. Lines may be split across calls. feed()
+    /// returns the current wait count or -1.
+    int feed(const char *buf, size_t len);
+    int finish();
+    int waitCount() const { return wait_count_; }
+    uint64_t linesFed() const { return feedLines_; }
+
+    void enableStats(const bool on);  /// phase timers, counters always run
+    decode_stats_t stats() const;
+
+    void setMaxFileSize(const uint64_t fsize);   /// in Bytes.
+    void setMaxLineSize(const size_t len);       /// longer lines are dropped
+    void setMaxWaiting(const int count);         /// unresolved refs, 0 = any
+    void setLargeInput(const bool large);        /// see decodeLarge()
+    void setInputMode(const InputMode mode);
+    void setErrorStream(ostream& err);           /// cerr unless set
+    void setPrintThreads(const unsigned int n);  /// > 1 prints in parallel
+    void setSkipBad(const bool skip);            /// see stitchRecord()
+
+    /// Every bad line of the last decode, whether or not it was skipped.
+    const DecodeErrors& errors() const { return errors_; }
+
+protected:
+    int markParentFilled(Node *n);
+    int insertHashMap(Node &n, Node **holder, Status s);
+    int checkHashMap(Node *n, Node **holder, Node *parent);
+
+    int processNode(Node *n, Node **holder,
+                    Node *parent); /// Helper to process new Node
+    void retireFilled(typename Index::slot *node_list);
+    Node *parseSpan(const char *line, size_t len, Alloc& nodes,
+                    StringPool& descrs,
+                    ParseError *err) const; /// Helper to process the line.
+    void printParseError(ParseError err) const;
+    int consumeLine(const char *line, size_t len, uint64_t line_off,
+                    uint64_t line_count, bool copy_descr);
+    int stitchRecord(Node *n, const char *line, size_t len,
+                     uint64_t line_count);
+    void badLine(ParseError err, const char *line, size_t len,
+                 uint64_t line_count);
+    bool noteError(DecodeError kind, Id id);
+    void journalRef(Id id, unsigned int i, const Ref& old);
+    void journalPtr(Node **ptr);
+    void beginRecord();
+    void undoRecord();
+    void commitRecord();
+    void settleSkipped();
+    int checkDecoded() const;
+    void appendPartial(const char *buf, size_t len);
+    int mapMappedFile();
+    double *timer(double& ms) { return (statsOn_ ? &ms : NULL); }
+    /// Printers are const and may run concurrently, see stats().
+    atomic<uint64_t> *traverseTimer() const
+    {
+        return (statsOn_ ? &traverseNs_ : NULL);
+    }
+    int decodeStream();
+    int decodeMapped();
+    int decodeLarge();
+    int decodeAsync();
+    int decodeCompressed();
+    int fileCheck(const string& fname);          /// is File and check limit.
+    const DescrSource *openSource() const;
+    /// Forget the tree, keep_memory keeps arenas and index capacity.
+    void clearTree(const bool keep_memory);
+
+    Node *decodedTree_;           /// The decoded tree.
+    /// Helps with late inserts and error checks.
+    /// the per id vector helps us maintain order of parsing.
+    Index insertMap_;
+    FlatIdSet<Id> retired_;       /// ids retireFilled() dropped, -L
+    int wait_count_;              /// if does not become zero then we have
+                                  /// bad input
+    string fname_;                /// Input filename
+    fstream inFile_;              /// Input File Stream
+    uint64_t maxFSize_;           /// Overrides the default
+    size_t maxLineSize_;          /// lines this long or longer are dropped
+    int maxWait_;                 /// fail once wait_count_ passes this
+    bool large_;                  /// read in blocks, retire FILLED entries
+    bool complete_tree_;          /// support for partial!
+    bool duplicate_ids_;          /// duplicate node id support.
+    InputMode mode_;              /// how decodeFile reads fname_
+    Codec codec_;                 /// fname_ is compressed, see fileCheck()
+    MappedFile mapped_;           /// descriptions point into this in MMAP
+    source_stamp_t stamp_;        /// fname_ as fileCheck() saw it
+    mutable DescrSource source_;  /// fname_ again, opened by the printers
+    mutable mutex sourceLock_;    /// concurrent printers open it once
+    Alloc nodes_;                 /// every Node incl. placeholders.
+    StringPool descrs_;           /// copied descriptions, exact length.
+    /// (new root, holder of the old one) per root shift, for updates.
+    vector<pair<Node *, Node **> > shiftLog_;
+    string feedPartial_;          /// unfinished line from the last feed()
+    uint64_t feedPartialOff_;     /// where feedPartial_ starts
+    uint64_t feedOff_;            /// bytes fed so far
+    uint64_t feedLines_;          /// lines seen by feed()
+    bool feedFailed_;             /// a fed line stopped the decode
+    bool statsOn_;                /// run the phase timers
+    unsigned int printThreads_;   /// see parallel_traverse.h
+    ostream *err_;                /// where decode errors are reported
+    decode_stats_t stats_;
+    mutable atomic<uint64_t> traverseNs_;  /// stats_.traverseMs_ of printers
+
+    bool skipBad_;                /// see stitchRecord()
+    DecodeErrors errors_;
+    DecodeError lastError_;       /// why processNode() failed
+    Id lastErrorId_;
+    /// What processNode() changed for the record being stitched, while
+    /// journaling_, undoRecord() puts it back.
+    enum class Undo : std::int8_t { REF, PUSH, PTR };
+    struct undo_step
+    {
+        Undo what_;
+        unsigned int i_;          /// REF: entry of id_'s slot
+        Id id_;                   /// REF, PUSH
+        Ref ref_;                 /// REF: as it was
+        Node **ptr_;              /// PTR: *ptr_ was old_
+        Node *old_;
+    };
+    bool journaling_;
+    vector<undo_step> journal_;
+    vector<Id> retiring_;         /// retireFilled() held back meanwhile
+    int savedWait_;
+    Node *savedRoot_;
+    size_t savedShifts_;
+
+private:
+    BasicBuildTree(const BasicBuildTree&);  /// no copies.
+    BasicBuildTree& operator=(const BasicBuildTree&);
+};
+
+/**
+ * Constructor
+ */
+template <typename Id, typename Payload, typename Alloc>
+BasicBuildTree<Id, Payload, Alloc>::BasicBuildTree()
+    : decodedTree_(NULL),
+      wait_count_(0),
+      maxFSize_(maxFSize),
+      maxLineSize_(maxLineSize),
+      maxWait_(0),
+      large_(false),
+      complete_tree_(true),
+      duplicate_ids_(false),
+      mode_(InputMode::STREAM),
+      codec_(Codec::NONE),
+      feedPartialOff_(0),
+      feedOff_(0),
+      feedLines_(0),
+      feedFailed_(false),
+      statsOn_(false),
+      printThreads_(1),
+      err_(&cerr),
+      traverseNs_(0),
+      skipBad_(false),
+      lastError_(DecodeError::NONE),
+      lastErrorId_(0),
+      journaling_(false),
+      savedWait_(0),
+      savedRoot_(NULL),
+      savedShifts_(0)
+{
+    memset(&stats_, 0, sizeof(stats_));
+    memset(&stamp_, 0, sizeof(stamp_));
+}
+
+/**
+ * Constructor with options!.
+ */
+template <typename Id, typename Payload, typename Alloc>
+BasicBuildTree<Id, Payload, Alloc>::BasicBuildTree(const string& fname,
+                                                   bool complete_tree,
+                                                   bool dup_ids)
+    : decodedTree_(NULL),
+      wait_count_(0),
+      maxFSize_(maxFSize),
+      maxLineSize_(maxLineSize),
+      maxWait_(0),
+      large_(false),
+      complete_tree_(complete_tree),
+      duplicate_ids_(dup_ids),
+      mode_(InputMode::STREAM),
+      codec_(Codec::NONE),
+      feedPartialOff_(0),
+      feedOff_(0),
+      feedLines_(0),
+      feedFailed_(false),
+      statsOn_(false),
+      printThreads_(1),
+      err_(&cerr),
+      traverseNs_(0),
+      skipBad_(false),
+      lastError_(DecodeError::NONE),
+      lastErrorId_(0),
+      journaling_(false),
+      savedWait_(0),
+      savedRoot_(NULL),
+      savedShifts_(0)
+{
+    memset(&stats_, 0, sizeof(stats_));
+    memset(&stamp_, 0, sizeof(stamp_));
+    if (fname.length() == 0)
+    {
+        *err_ << "Invalid fname" << endl;
+        return;
+    }
+
+    fname_ = fname;
+}
+
+/**
+ * Destructor.
+ */
+template <typename Id, typename Payload, typename Alloc>
+BasicBuildTree<Id, Payload, Alloc>::~BasicBuildTree()
+{
+    if (inFile_.is_open())
+    {
+        inFile_.close();
+    }
+
+    clearTree(false);
+    mapped_.close();
+}
+
+/**
+ * Drop the HashMap and the decoded tree. Nodes and descriptions live in
+ * the arenas so the tree goes in one shot.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::clearTree(const bool keep_memory)
+{
+    insertMap_.clear();
+    retired_.clear();
+    shiftLog_.clear();
+
+    decodedTree_ = NULL;
+    wait_count_ = 0;
+    if (keep_memory) {
+        nodes_.reset();
+        descrs_.reset();
+    } else {
+        nodes_.release();
+        descrs_.release();
+    }
+
+    feedPartial_.clear();
+    feedPartialOff_ = 0;
+    feedOff_ = 0;
+    feedLines_ = 0;
+    feedFailed_ = false;
+    source_.close();
+    errors_.clear();
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setMaxFileSize(const uint64_t fsize)
+{
+    maxFSize_ = fsize;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setMaxLineSize(const size_t len)
+{
+    maxLineSize_ = len;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setMaxWaiting(const int count)
+{
+    maxWait_ = count;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setLargeInput(const bool large)
+{
+    large_ = large;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setInputMode(const InputMode mode)
+{
+    mode_ = mode;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setErrorStream(ostream& err)
+{
+    err_ = &err;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setPrintThreads(const unsigned int threads)
+{
+    printThreads_ = (threads == 0 ? 1 : threads);
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::setSkipBad(const bool skip)
+{
+    skipBad_ = skip;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::enableStats(const bool on)
+{
+    statsOn_ = on;
+}
+
+/**
+ * Counters kept elsewhere (arena, index probes) are folded in here.
+ */
+template <typename Id, typename Payload, typename Alloc>
+decode_stats_t
+BasicBuildTree<Id, Payload, Alloc>::stats() const
+{
+    decode_stats_t st = stats_;
+    st.traverseMs_ = traverseNs_.load() / 1e6;
+    st.nodes_ = nodes_.size();
+    st.collisions_ = insertMap_.probes() - st.lookups_;
+    return st;
+}
+
+/**
+ * mapped_.open() under the io timer.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::mapMappedFile()
+{
+    PhaseTimer t(timer(stats_.ioMs_));
+    return mapped_.open(fname_, *err_);
+}
+
+/**
+ * Helps with stopping bad filenames and files that exceed the limit
+ * we expect.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::fileCheck(const string& fname)
+{
+    struct stat sbuf;
+    memset(&sbuf, 0, sizeof(sbuf));
+    if (::stat(fname.c_str(), &sbuf) == -1) {
+        *err_ << "stat Error for fname : " << fname << " "
+              << strerror(errno) << endl;
+        return(-1);
+    }
+
+    if (!S_ISREG(sbuf.st_mode)) {
+        *err_ << "fname : " << fname
+              << " is not a regular file" << endl;
+        return(-1);
+    }
+
+    if ((uint64_t)sbuf.st_size > maxFSize_) {
+        *err_ << "fname : " << fname
+              << " size : " << sbuf.st_size
+              << " exceeded max size : " << maxFSize_ << endl;
+        return(-1);
+    }
+
+    stampOf(sbuf, &stamp_);
+    return sniffCodec(fname, &codec_, *err_);
+}
+
+/**
+ * Insert a new node into the hashMap, here except for the first time
+ * rest of the nodes will reside in either NODE_WAIT(with description)
+ * and NONNODE_WAIT (leaves waiting for nodes with description)
+ * This along with checkHashMap helps with O(1) inserts for the
+ * tree.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::insertHashMap(Node &n, Node **holder,
+                                                  Status s)
+{
+    // first time.
+    Ref href;
+    memset(&href, 0, sizeof(Ref));
+    href.nodePtr_ = holder;
+
+    if (insertMap_.empty()) {
+        // first insert set the root.
+        decodedTree_ = &n;
+        href.nodePtr_ = &decodedTree_;
+        s = Status::FILLED;
+    }
+
+    if (s == Status::NODE_WAIT) {
+        href.nodePtr_ = (Node **)&n; ///XXX: Hack :(
+    }
+
+    if (s != Status::FILLED)
+    {
+        if (maxWait_ > 0 && wait_count_ >= maxWait_) {
+            noteError(DecodeError::WAIT_LIMIT, n.id_);
+            *err_ << "exceeded unresolved node limit : " << maxWait_ << endl;
+            return -EINVAL;
+        }
+        wait_count_++;
+        if (wait_count_ > stats_.peakWait_)
+            stats_.peakWait_ = wait_count_;
+        if (s == Status::NODE_WAIT)
+            stats_.nodeWait_++;
+        else
+            stats_.nonNodeWait_++;
+    }
+    href.status_ = s;
+    stats_.lookups_++;
+    insertMap_.insert(n.id_)->push_back(href);
+    if (journaling_) {
+        undo_step u;
+        memset(&u, 0, sizeof(u));
+        u.what_ = Undo::PUSH;
+        u.id_ = n.id_;
+        journal_.push_back(u);
+    }
+    return(0);
+}
+
+/**
+ * Helps with reducing wait_count when root gets shifted.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::markParentFilled(Node *n)
+{
+    stats_.lookups_++;
+    typename Index::slot *node_list = insertMap_.find(n->id_);
+    if (!node_list)
+        return(-1);
+
+     for (unsigned int i = 0; i < node_list->size(); ++i) {
+         Ref* ln = &node_list->at(i);
+         if (ln->status_ == Status::NODE_WAIT)
+         {
+             journalRef(n->id_, i, *ln);
+             ln->status_ = Status::FILLED;
+             stats_.filled_++;
+             wait_count_--;
+             retireFilled(node_list);
+             return(0);
+         }
+     }
+
+     return(-1);
+}
+
+/**
+ * Large input only: once every ref of an id is FILLED nothing will look
+ * at it again, unless it holds the root (root shifts go through it).
+ * Dropping it keeps insertMap_ as big as the unresolved refs rather than
+ * the file. Only the id stays behind, in retired_, so checkHashMap()
+ * still refuses it when it is used again.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::retireFilled(
+    typename Index::slot *node_list)
+{
+    if (!large_)
+        return;
+    if (journaling_) {
+        // the record may still be taken back, see commitRecord().
+        retiring_.push_back(node_list->key_);
+        return;
+    }
+
+    for (unsigned int i = 0; i < node_list->size(); ++i) {
+        const Ref& ln = node_list->at(i);
+        if (ln.status_ != Status::FILLED || ln.nodePtr_ == &decodedTree_)
+            return;
+    }
+    retired_.insert(node_list->key_);
+    insertMap_.erase(node_list);
+}
+
+/**
+ * Main method for stiching disjoint trees together as more info
+ * comes in.
+ * Every id keeps a small vector of refs in the index to help us support
+ * same integer used in many nodes.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::checkHashMap(Node *n, Node** holder,
+                                                 Node *parent)
+{
+    stats_.lookups_++;
+    typename Index::slot *node_list = insertMap_.find(n->id_);
+    if (node_list) {
+        // found something.
+        bool is_filled = false;
+        for (unsigned int i = 0; i < node_list->size(); ++i) {
+            Ref* ln = &node_list->at(i);
+            // hit, check if this in wait state.
+            if (ln->status_ == Status::FILLED &&
+                ln->nodePtr_ != &decodedTree_)
+                continue; // not interesting spoken for.
+
+            // this is wait state.
+            // lets insert this into the tree and mark it as filled.
+
+            /* two cases here.
+             * 1. non node found a node.
+             * 2. node found a non node.
+             */
+            journalRef(n->id_, i, *ln);
+
+            switch(ln->status_) {
+            case Status::NODE_WAIT: {
+                // check we are not asked to handle an unfilled node.
+                if (n->present() || holder == NULL) {
+                    if (duplicate_ids_) {
+                        return(-1);
+                    }
+
+                    if (noteError(DecodeError::NODE_WAIT, n->id_)) {
+                        *err_ << "NODE_WAIT: ";
+                        n->describe(*err_);
+                        *err_ << " : found for node_id "
+                              << n->id_ << endl;
+                    }
+                    return -EINVAL;
+                }
+
+                Node *tn = (Node *)ln->nodePtr_;
+                *holder = tn;
+                ln->nodePtr_ = holder;
+                wait_count_--;
+                break;
+            }
+            case Status::NONNODE_WAIT: {
+                // check we have a node
+                if (!n->present()) {
+                    if (duplicate_ids_) {
+                        return(-1);
+                    }
+                    if (noteError(DecodeError::NONNODE_WAIT, n->id_))
+                        *err_ << "NONENODE_WAIT: " << n->id_ << endl;
+                    return -EINVAL;
+                }
+
+                journalPtr(ln->nodePtr_);
+                *ln->nodePtr_ = n;     // placeholder stays in the arena.
+                wait_count_--;
+                break;
+            }
+            case Status::FILLED: {
+                // This is only possible if ln is pointed by root so adjust
+                // the root.
+                if (n->present()) {
+                    // if we are replacing root then we better be a
+                    // non node.
+                    if (noteError(DecodeError::ROOT, n->id_)) {
+                        *err_ << "FILLED: ";
+                        n->describe(*err_);
+                        *err_ << " : descr found for node_id "
+                              << n->id_ << endl;
+                    }
+                    return -EINVAL;
+                }
+
+                if (!parent) {
+                    // if we are taking ownership of root then we better
+                    // have one.
+                    if (noteError(DecodeError::ROOT, n->id_))
+                        *err_ << "PARENT: not found for node_id "
+                              << n->id_ << endl;
+                    return -EINVAL;
+                }
+
+                *holder = *ln->nodePtr_; // lets take current root.
+                decodedTree_ = parent; // point to new root.
+                stats_.rootShifts_++;
+                shiftLog_.push_back(make_pair(parent, holder));
+
+                if (markParentFilled(parent) < 0) {
+                    if (noteError(DecodeError::ROOT, parent->id_))
+                        *err_ << "Could not mark FILLED for parent : "
+                              << parent->id_ << endl;
+                    return -EINVAL;
+                }
+
+                break;
+            }
+            default:
+                *err_ << "node status is : " << (int)ln->status_ << endl;
+                assert(false);
+            }
+
+            if (ln->status_ != Status::FILLED)
+                stats_.filled_++;
+            ln->status_ = Status::FILLED;
+            is_filled = true;
+            retireFilled(node_list);
+            break;
+        }
+
+        if (!is_filled) {
+            if (duplicate_ids_) {
+                return(-1);
+            }
+
+            if (noteError(DecodeError::DUPLICATE, n->id_))
+                *err_ << "node not filled : " << n->id_ << endl;
+            return(-EINVAL);
+        }
+
+        return(0);
+    }
+
+    // every ref of a retired id was FILLED, same as !is_filled above.
+    if (!retired_.empty() && retired_.contains(n->id_)) {
+        if (duplicate_ids_) {
+            return(-1);
+        }
+
+        if (noteError(DecodeError::DUPLICATE, n->id_))
+            *err_ << "node not filled : " << n->id_ << endl;
+        return(-EINVAL);
+    }
+
+    return(-1); // not found
+}
+
+/**
+ * Consume each node and place at the right place in the tree
+ * or store it for future use.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::processNode(Node *n, Node **holder,
+                                                Node *parent)
+{
+    // checkHashMap() drops n when it only was a placeholder, those never
+    // have children so remember that before n goes away.
+    bool has_children = (n->left_ != NULL || n->right_ != NULL);
+
+    // first check if we have an existing entry for n->id_ in this.
+    int ret = checkHashMap(n, holder, parent);
+
+    Status s = Status::FILLED;
+    if (ret < 0) { // not found.
+        if (ret == -EINVAL)
+            return(ret);
+
+        s = Status::NODE_WAIT;
+        if (!n->present()) {
+            s = Status::NONNODE_WAIT;
+        }
+
+        if (insertHashMap(*n, holder, s) < 0)
+            return -EINVAL;
+   }
+
+    if (!has_children)
+        return(0);
+
+    // now try the left and right.
+    if (n->left_) {
+        ret = processNode(n->left_, &n->left_, n);
+        if (ret == -EINVAL) {
+            return(ret);
+        }
+    }
+
+    if (n->right_) {
+        ret = processNode(n->right_, &n->right_, n);
+        if (ret == -EINVAL) {
+            return(ret);
+        }
+    }
+
+    return(0);
+}
+
+/**
+ * Parse one line, "<id> [<left> [<right>]] [payload]". Works on the
+ * text in place, scanHead() finds the numbers and the payload takes the
+ * rest (text_payload points into it instead of copying it out).
+ * Touches nothing but the given arenas so worker threads can call it,
+ * failures are returned in err and reported by printParseError().
+ */
+template <typename Id, typename Payload, typename Alloc>
+typename BasicBuildTree<Id, Payload, Alloc>::Node *
+BasicBuildTree<Id, Payload, Alloc>::parseSpan(const char *line, size_t len,
+                                              Alloc& nodes,
+                                              StringPool& descrs,
+                                              ParseError *err) const
+{
+    *err = ParseError::NONE;
+    if (len >= maxLineSize_) {
+        *err = ParseError::TOO_LONG;
+        return NULL;
+    }
+
+    line_head_t head;
+    scanHead(line, len, &head);
+    const char *end = line + len;
+    unsigned int ids = (head.count_ == 0 ? 0 :
+                        Payload::idCount(head, end, complete_tree_));
+    if (ids == 0) {
+        *err = ParseError::NO_ID;
+        return NULL;
+    }
+
+    Node *n = nodes.alloc();
+    n->id_ = (Id)head.vals_[0];
+    if (ids > 1) {
+        n->left_ = nodes.alloc();
+        n->left_->id_ = (Id)head.vals_[1];
+    }
+    if (ids > 2) {
+        n->right_ = nodes.alloc();
+        n->right_->id_ = (Id)head.vals_[2];
+    }
+
+    if (!n->template parse<Id>(head, ids, end, descrs)) {
+        *err = ParseError::BAD_PAYLOAD;
+        return NULL;              /// what was allocated stays in the arena.
+    }
+    return n;
+}
+
+/**
+ * Why parseSpan() could not use a line.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::printParseError(ParseError err) const
+{
+    switch (err) {
+    case ParseError::TOO_LONG:
+        *err_ << "exceeded size : " << maxLineSize_ << endl;
+        break;
+    case ParseError::NO_ID:
+        *err_ << "Cannot parse line" << endl;
+        break;
+    case ParseError::BAD_PAYLOAD:
+        *err_ << "Cannot parse payload" << endl;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Main method that interfaces external world. Use this to start
+ * decoding.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeFile()
+{
+    if (fileCheck(fname_) < 0)
+        return -1;
+
+    // finish() does the checks for these three.
+    if (codec_ != Codec::NONE)
+        return decodeCompressed();
+    if (mode_ == InputMode::ASYNC)
+        return decodeAsync();
+    if (large_)
+        return decodeLarge();
+
+    int ret = 0;
+    if (mode_ == InputMode::MMAP) {
+        ret = decodeMapped();
+    } else {
+        ret = decodeStream();
+    }
+    if (ret < 0)
+        return(-1);
+
+    settleSkipped();
+    return checkDecoded();
+}
+
+/**
+ * Final verdict once every line went through processNode().
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::checkDecoded() const
+{
+    if (wait_count_ > 0) {
+        *err_ << "Error - unresolved node count : " << wait_count_ << endl;
+        return(-1);
+    }
+
+    // After all the effort if the root is empty then no go.
+    if (decodedTree_ == NULL) {
+        *err_ << "Error - could not build any tree!" << endl;
+        return(-1);
+    }
+
+    return 0;
+}
+
+/**
+ * Line by line through an fstream.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeStream()
+{
+    // open the fstream and start the big loop!.
+    {
+        PhaseTimer t(timer(stats_.ioMs_));
+        inFile_.open(fname_.c_str(), fstream::in);
+    }
+    if (!inFile_) {
+        // TODO: Print error.
+        *err_ << fname_ << " : error in open " << endl;
+        return -1;
+    }
+
+    uint64_t line_count = 0;
+    uint64_t next_off = 0;
+    string line;
+    while(!inFile_.eof()) {
+        line.clear();
+        {
+            PhaseTimer t(timer(stats_.ioMs_));
+            getline(inFile_, line);
+        }
+        uint64_t line_off = next_off;
+        next_off += line.length() + 1;
+        if (line.length() == 0)
+            continue;
+
+        // copies the description, line is reused.
+        if (consumeLine(line.data(), line.length(), line_off, ++line_count,
+                        true) < 0) {
+            inFile_.close();
+            return(-1);
+        }
+    }
+
+    inFile_.close();
+    return 0;
+}
+
+/**
+ * Walk the mapped file, lines are never copied, see parseSpan().
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeMapped()
+{
+    if (mapMappedFile() < 0)
+        return -1;
+
+    uint64_t line_count = 0;
+    const char *end = mapped_.end();
+    const char *dropped = mapped_.begin();
+    for (const char *p = mapped_.begin(); p < end; ) {
+        // payloads that keep no text let go of what was parsed.
+        if (!Payload::keepsMapping &&
+            (size_t)(p - dropped) >= mappedDropSize) {
+            mapped_.dropBefore(p);
+            dropped = p;
+        }
+
+        const char *line = p;
+        const char *nl = findNewline(p, end);
+        size_t len = nl - line;
+        p = (nl < end ? nl + 1 : end);
+        if (len == 0)
+            continue;
+
+        if (consumeLine(line, len, line - mapped_.begin(), ++line_count,
+                        false) < 0)
+            return(-1);
+    }
+
+    // nothing points into the mapping, the tree is all that stays.
+    if (!Payload::keepsMapping)
+        mapped_.close();
+    return 0;
+}
+
+/**
+ * parseSpan() + processNode() for one line, copy_descr when the line
+ * will not outlive the tree (see feed()). line_off is where the line
+ * starts in the input.
+ * Returns -1 only if decoding has to stop.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::consumeLine(const char *line, size_t len,
+                                                uint64_t line_off,
+                                                uint64_t line_count,
+                                                bool copy_descr)
+{
+    stats_.lines_++;
+
+    ParseError err;
+    Node *n = NULL;
+    {
+        PhaseTimer t(timer(stats_.parseMs_));
+        n = parseSpan(line, len, nodes_, descrs_, &err);
+    }
+    if (!n) {
+        badLine(err, line, len, line_count);
+        return(0);
+    }
+
+    if (copy_descr)
+        n->keep(line, len, descrs_);
+    n->locate(line_off, len);
+
+    PhaseTimer t(timer(stats_.stitchMs_));
+    return stitchRecord(n, line, len, line_count);
+}
+
+/**
+ * processNode() for a record that parsed. Normally the first record
+ * that does not fit stops the decode. With setSkipBad() it is taken
+ * back out, every change it made is undone from the journal, and the
+ * decode goes on without it. Either way errors() gets it.
+ * Returns -1 only if decoding has to stop.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::stitchRecord(Node *n, const char *line,
+                                                 size_t len,
+                                                 uint64_t line_count)
+{
+    lastError_ = DecodeError::NONE;
+    lastErrorId_ = n->id_;
+    if (skipBad_)
+        beginRecord();
+
+    if (processNode(n, NULL, NULL) >= 0) {
+        if (skipBad_)
+            commitRecord();
+        return(0);
+    }
+
+    errors_.add(line_count, (int64_t)lastErrorId_, lastError_);
+    if (skipBad_ && lastError_ != DecodeError::WAIT_LIMIT) {
+        undoRecord();
+        return(0);
+    }
+
+    journaling_ = false;
+    *err_ << line_count << " : Error line - ";
+    err_->write(line, len) << endl;
+    return(-1);
+}
+
+/**
+ * A line parseSpan() refused, never fatal.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::badLine(ParseError err, const char *line,
+                                            size_t len, uint64_t line_count)
+{
+    errors_.add(line_count, 0, DecodeError::PARSE, err);
+    if (skipBad_)
+        return;
+
+    printParseError(err);
+    *err_ << line_count << " : Error line - ";
+    err_->write(line, len) << endl;
+}
+
+/**
+ * Why processNode() is about to fail. True if the diagnostic should
+ * be printed, a record that will be skipped only goes to errors().
+ */
+template <typename Id, typename Payload, typename Alloc>
+bool
+BasicBuildTree<Id, Payload, Alloc>::noteError(DecodeError kind, Id id)
+{
+    lastError_ = kind;
+    lastErrorId_ = id;
+    return !journaling_;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::journalRef(Id id, unsigned int i,
+                                               const Ref& old)
+{
+    if (!journaling_)
+        return;
+
+    undo_step u;
+    memset(&u, 0, sizeof(u));
+    u.what_ = Undo::REF;
+    u.i_ = i;
+    u.id_ = id;
+    u.ref_ = old;
+    journal_.push_back(u);
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::journalPtr(Node **ptr)
+{
+    if (!journaling_)
+        return;
+
+    undo_step u;
+    memset(&u, 0, sizeof(u));
+    u.what_ = Undo::PTR;
+    u.ptr_ = ptr;
+    u.old_ = *ptr;
+    journal_.push_back(u);
+}
+
+/**
+ * Start of a record that may have to be taken back. Only refs, slots
+ * and child pointers of earlier nodes need the journal, the record's
+ * own nodes are dropped with it.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::beginRecord()
+{
+    journaling_ = true;
+    journal_.clear();
+    retiring_.clear();
+    savedWait_ = wait_count_;
+    savedRoot_ = decodedTree_;
+    savedShifts_ = shiftLog_.size();
+}
+
+/**
+ * Newest change first, so slot entries are where the journal says.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::undoRecord()
+{
+    for (size_t k = journal_.size(); k-- > 0; ) {
+        const undo_step& u = journal_[k];
+        switch (u.what_) {
+        case Undo::REF:
+            insertMap_.find(u.id_)->at(u.i_) = u.ref_;
+            break;
+        case Undo::PUSH: {
+            typename Index::slot *node_list = insertMap_.find(u.id_);
+            if (node_list->size() > 1)
+                node_list->pop_back();
+            else
+                insertMap_.erase(node_list);
+            break;
+        }
+        case Undo::PTR:
+            *u.ptr_ = u.old_;
+            break;
+        }
+    }
+
+    wait_count_ = savedWait_;
+    decodedTree_ = savedRoot_;
+    shiftLog_.resize(savedShifts_);
+    journaling_ = false;
+    journal_.clear();
+    retiring_.clear();
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::commitRecord()
+{
+    journaling_ = false;
+    for (size_t k = 0; k < retiring_.size(); ++k) {
+        typename Index::slot *node_list = insertMap_.find(retiring_[k]);
+        if (node_list)
+            retireFilled(node_list);
+    }
+    retiring_.clear();
+}
+
+/**
+ * setSkipBad() at the end of the input: what still waits cannot be
+ * resolved any more. Child references nobody filled are cut off, which
+ * leaves the root's tree and every record nobody referred to as whole
+ * trees, and the biggest of those is the result. The ids are listed in
+ * errors() in increasing order, not in insertMap_ order, so the same
+ * input reports the same ids in every mode. Nothing waits any more.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::settleSkipped()
+{
+    if (!skipBad_ || wait_count_ == 0)
+        return;
+
+    vector<Node *> orphans;
+    vector<int64_t> ids;
+    insertMap_.forEach([&](typename Index::slot& node_list) {
+        for (unsigned int i = 0; i < node_list.size(); ++i) {
+            Ref& ln = node_list.at(i);
+            if (ln.status_ == Status::NONNODE_WAIT) {
+                *ln.nodePtr_ = NULL;
+            } else if (ln.status_ == Status::NODE_WAIT) {
+                orphans.push_back((Node *)ln.nodePtr_);
+            } else {
+                continue;
+            }
+            ids.push_back((int64_t)node_list.key_);
+            ln.status_ = Status::FILLED;
+        }
+    });
+    sort(ids.begin(), ids.end());
+    for (size_t k = 0; k < ids.size(); ++k)
+        errors_.addUnresolved(ids[k]);
+
+    uint64_t best = 0;
+    if (decodedTree_) {
+        PreOrderIter<Node> it(decodedTree_);
+        while (it.next())
+            best++;
+    }
+    for (size_t k = 0; k < orphans.size(); ++k) {
+        uint64_t size = 0;
+        PreOrderIter<Node> it(orphans[k]);
+        while (it.next())
+            size++;
+        if (size > best) {
+            best = size;
+            decodedTree_ = orphans[k];
+        }
+    }
+    wait_count_ = 0;
+}
+
+/**
+ * Push style decoding for producers that hand us the encoded tree in
+ * pieces (pipes, sockets) instead of a file.
+ *   while (read(fd, buf, sz) > 0) bt.feed(buf, n);
+ *   bt.finish();
+ * Parser and insertMap_ state carry over between calls, a line cut at a
+ * buffer boundary waits in feedPartial_ for the rest of it.
+ * Consumes all complete lines in buf. Descriptions are copied into the
+ * pool since buf belongs to the caller.
+ * Returns wait_count_ so far, or -1 once a line failed to stitch.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::feed(const char *buf, size_t len)
+{
+    if (feedFailed_)
+        return(-1);
+
+    const char *end = buf + len;
+    const char *p = buf;
+    uint64_t base = feedOff_;
+    feedOff_ += len;
+    if (!feedPartial_.empty()) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (!nl) {
+            appendPartial(p, len);
+            return wait_count_;
+        }
+
+        appendPartial(p, nl - p);
+        p = nl + 1;
+        int ret = consumeLine(feedPartial_.data(), feedPartial_.size(),
+                              feedPartialOff_, ++feedLines_, true);
+        feedPartial_.clear();
+        if (ret < 0) {
+            feedFailed_ = true;
+            return(-1);
+        }
+    }
+
+    while (p < end) {
+        const char *nl = findNewline(p, end);
+        if (nl == end) {
+            feedPartialOff_ = base + (p - buf);
+            appendPartial(p, end - p);
+            break;
+        }
+
+        const char *line = p;
+        size_t line_len = nl - p;
+        p = nl + 1;
+        if (line_len == 0)
+            continue;
+
+        if (consumeLine(line, line_len, base + (line - buf), ++feedLines_,
+                        true) < 0) {
+            feedFailed_ = true;
+            return(-1);
+        }
+    }
+
+    return wait_count_;
+}
+
+/**
+ * End of input, the last line need not end with a newline.
+ * Same checks as decodeFile().
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::finish()
+{
+    if (feedFailed_)
+        return(-1);
+
+    if (!feedPartial_.empty()) {
+        int ret = consumeLine(feedPartial_.data(), feedPartial_.size(),
+                              feedPartialOff_, ++feedLines_, true);
+        feedPartial_.clear();
+        if (ret < 0) {
+            feedFailed_ = true;
+            return(-1);
+        }
+    }
+
+    settleSkipped();
+    return checkDecoded();
+}
+
+/**
+ * A line without a newline in sight is kept only up to maxLineSize_,
+ * parseSpan() drops it anyway and memory stays bounded.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::appendPartial(const char *buf, size_t len)
+{
+    if (feedPartial_.size() >= maxLineSize_)
+        return;
+
+    size_t room = maxLineSize_ - feedPartial_.size();
+    feedPartial_.append(buf, len < room ? len : room);
+}
+
+/**
+ * Large input mode: the file is read in fixed size blocks and pushed
+ * through feed(), so no more than one block and one partial line is
+ * held in memory however big the file is (file size is 64 bit, see
+ * setMaxFileSize()). With retireFilled() the index only holds refs
+ * that are still waiting, what remains is the tree itself.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeLarge()
+{
+    int fd = -1;
+    {
+        PhaseTimer t(timer(stats_.ioMs_));
+        fd = ::open(fname_.c_str(), O_RDONLY);
+    }
+    if (fd < 0) {
+        *err_ << fname_ << " : error in open " << strerror(errno) << endl;
+        return(-1);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    vector<char> buf(largeReadSize);
+    int ret = 0;
+    for (;;) {
+        ssize_t n = 0;
+        {
+            PhaseTimer t(timer(stats_.ioMs_));
+            n = ::read(fd, &buf[0], buf.size());
+        }
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            *err_ << fname_ << " : read error " << strerror(errno) << endl;
+            ret = -1;
+            break;
+        }
+        if (feed(&buf[0], n) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    ::close(fd);
+    if (ret < 0)
+        return(-1);
+    return finish();
+}
+
+/**
+ * InputMode::ASYNC: the next few blocks are being read while feed()
+ * parses and stitches this one, see read_ahead.h. ioMs_ is the time
+ * spent waiting for a block that was not there yet. Honours large
+ * input mode the same way decodeLarge() does, memory is depth blocks.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeAsync()
+{
+    ReadAhead ra(largeReadSize, readAheadDepth);
+    {
+        PhaseTimer t(timer(stats_.ioMs_));
+        if (ra.open(fname_, *err_) < 0)
+            return(-1);
+    }
+
+    for (;;) {
+        const char *buf = NULL;
+        size_t len = 0;
+        int ret = 0;
+        {
+            PhaseTimer t(timer(stats_.ioMs_));
+            ret = ra.next(&buf, &len);
+        }
+        if (ret == 0)
+            break;
+        if (ret < 0 || feed(buf, len) < 0)
+            return(-1);
+    }
+
+    return finish();
+}
+
+/**
+ * gzip or zstd input (fileCheck() looked at the magic bytes): the next
+ * few blocks are decompressed on another thread while feed() parses
+ * and stitches this one, see decompress.h. Nothing of the file stays
+ * mapped, so descriptions are copied and cannot be read back later.
+ * maxFSize_ applies to the decompressed text.
+ */
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::decodeCompressed()
+{
+    if (Payload::readsSource) {
+        *err_ << fname_ << " : descriptions cannot be read back from "
+              << codecName(codec_) << " input" << endl;
+        return(-1);
+    }
+
+    Decompressor dz(largeReadSize, readAheadDepth);
+    {
+        PhaseTimer t(timer(stats_.ioMs_));
+        if (dz.open(fname_, *err_) < 0)
+            return(-1);
+    }
+
+    for (;;) {
+        const char *buf = NULL;
+        size_t len = 0;
+        int ret = 0;
+        {
+            PhaseTimer t(timer(stats_.ioMs_));
+            ret = dz.next(&buf, &len);
+        }
+        if (ret == 0)
+            break;
+        if (ret < 0)
+            return(-1);
+        if (feedOff_ + len > maxFSize_) {
+            *err_ << "fname : " << fname_
+                  << " decompressed size exceeded max size : "
+                  << maxFSize_ << endl;
+            return(-1);
+        }
+        if (feed(buf, len) < 0)
+            return(-1);
+    }
+
+    return finish();
+}
+
+/**
+ * Default output goes to stdout, cout is flushed first so anything the
+ * caller wrote there stays in order.
+ */
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::printBFS() const
+{
+    cout.flush();
+    FdSink out(STDOUT_FILENO);
+    printBFS(out);
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::printDFS() const
+{
+    cout.flush();
+    FdSink out(STDOUT_FILENO);
+    printDFS(out);
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::printBFS(OutputSink& sink) const
+{
+    if (!decodedTree_)
+        return;
+
+    const DescrSource *src = NULL;
+    if (Payload::readsSource && (src = openSource()) == NULL)
+        return;
+
+    SharedPhaseTimer t(traverseTimer());
+    if (printThreads_ > 1) {
+        printLevelOrder(decodedTree_, printThreads_, sink,
+                        [src](BufferedWriter& out, const Node *t) {
+            t->template print<Id>(out, t->id_, src);
+            out.put(' ');
+        });
+        return;
+    }
+
+    BufferedWriter out(sink);
+    LevelOrderIter<Node> it(decodedTree_);
+    for (const Node *t; (t = it.next()) != NULL; ) {
+        t->template print<Id>(out, t->id_, src);
+        out.put(' ');
+    }
+
+    out.put('\n');
+    return;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::printDFS(OutputSink& sink) const
+{
+    const DescrSource *src = NULL;
+    if (decodedTree_ && Payload::readsSource &&
+        (src = openSource()) == NULL)
+        return;
+
+    SharedPhaseTimer t(traverseTimer());
+    if (decodedTree_ && printThreads_ > 1) {
+        printInOrder(decodedTree_, printThreads_, sink,
+                     [src](BufferedWriter& out, const Node *t) {
+            t->template print<Id>(out, t->id_, src);
+            out.put(' ');
+        });
+        return;
+    }
+
+    BufferedWriter out(sink);
+    InOrderIter<Node> it(decodedTree_);
+    for (const Node *t; (t = it.next()) != NULL; ) {
+        t->template print<Id>(out, t->id_, src);
+        out.put(' ');
+    }
+
+    out.put('\n');
+    return;
+}
+
+/**
+ * fname_ mapped again for the payloads that kept offsets into it,
+ * on the first print after the decode. NULL (reported) if the file
+ * changed since or is not a file (feed() from stdin).
+ */
+template <typename Id, typename Payload, typename Alloc>
+const DescrSource *
+BasicBuildTree<Id, Payload, Alloc>::openSource() const
+{
+    lock_guard<mutex> lock(sourceLock_);
+    if (!source_.isOpen() && source_.open(fname_, stamp_, *err_) < 0)
+        return NULL;
+    return &source_;
+}
+
+template <typename Id, typename Payload, typename Alloc>
+void
+BasicBuildTree<Id, Payload, Alloc>::releaseSource()
+{
+    source_.close();
+}
+
+template <typename Id, typename Payload, typename Alloc>
+int
+BasicBuildTree<Id, Payload, Alloc>::materialize(const Node *n,
+                                                string& out) const
+{
+    const DescrSource *src = NULL;
+    if (Payload::readsSource && (src = openSource()) == NULL)
+        return(-1);
+
+    StringSink sink;
+    {
+        BufferedWriter w(sink, 256);
+        n->template print<Id>(w, n->id_, src);
+    }
+    out.swap(sink.str());
+    return(0);
+}
+
+#endif
@@ -0,0 +1,214 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:batch_decode.cc
+ * Many inputs in one process, see batch_decode.h. Workers pull the next
+ * file index off an atomic counter, the calling thread waits for the
+ * results in input order and writes each one out as soon as everything
+ * before it has been written, then drops it. A worker does not start a
+ * file more than batchAhead files per worker past the one being written,
+ * so a slow early file holds back the batch and not its output.
+ */
+
+#include "batch_decode.h"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+const size_t batchSkippedShown = 20;    /// -k summary lines per file
+const size_t batchAhead = 2;            /// results held per worker, at most
+
+/// One file's outcome, held until it is its turn to be reported.
+typedef struct batch_result
+{
+    string out_;                  /// BFS and DFS lines
+    string err_;                  /// what the decode wrote to its err_
+    bool failed_;
+    bool done_;
+} batch_result_t;
+
+int
+readManifest(const string& fname, vector<string>& files)
+{
+    ifstream in(fname.c_str());
+    if (!in) {
+        cerr << fname << " : error in open " << endl;
+        return(-1);
+    }
+
+    for (string line; getline(in, line); ) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == string::npos || line[begin] == '#')
+            continue;
+        size_t end = line.find_last_not_of(" \t\r");
+        files.push_back(line.substr(begin, end + 1 - begin));
+    }
+    return(0);
+}
+
+/**
+ * Decode one file into res with a tree left over from the previous one.
+ */
+static void
+decodeOne(unique_ptr<BuildTree>& bt, const string& fname,
+          const batch_options_t& opts, batch_result_t& res)
+{
+    if (!bt) {
+        string name(fname);
+        bt.reset(new BuildTree(name, opts.complete_, opts.dupIds_));
+        bt->setInputMode(opts.mode_);
+        bt->setSkipBad(opts.skipBad_);
+        bt->enableStats(opts.stats_);
+        if (opts.large_) {
+            bt->setLargeInput(true);
+            bt->setMaxFileSize(opts.maxFSize_);
+            bt->setMaxLineSize(opts.maxLineSize_);
+        }
+    } else {
+        bt->reuse(fname);
+    }
+
+    ostringstream err;
+    bt->setErrorStream(err);
+
+    res.failed_ = true;
+    int ret = bt->decodeFile();
+    if (opts.skipBad_)
+        bt->errors().printSummary(err, batchSkippedShown);
+    if (ret < 0) {
+        err << "Error decoding file." << endl;
+    } else if (opts.compact_ && bt->compact(opts.layout_) < 0) {
+        err << "Error compacting tree." << endl;
+    } else {
+        StringSink sink;
+        bt->printBFS(sink);
+        bt->printDFS(sink);
+        res.out_.swap(sink.str());
+        res.failed_ = false;
+    }
+
+    if (opts.stats_)
+        printStatsJson(err, bt->stats());
+    res.err_ = err.str();
+    bt->setErrorStream(cerr);   /// err goes away with this frame.
+}
+
+/**
+ * Prefix every line of text with the file name.
+ */
+static void
+reportErrors(ostream& err, const string& fname, const string& text)
+{
+    size_t pos = 0;
+    while (pos < text.length()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == string::npos)
+            nl = text.length();
+        err << fname << " : ";
+        err.write(text.data() + pos, nl - pos) << '\n';
+        pos = nl + 1;
+    }
+}
+
+size_t
+decodeBatch(const vector<string>& files, unsigned int workers,
+            const batch_options_t& opts, OutputSink& out, ostream& err)
+{
+    if (workers == 0)
+        workers = 1;
+    if (workers > files.size())
+        workers = files.size();
+
+    vector<batch_result_t> results(files.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].failed_ = false;
+        results[i].done_ = false;
+    }
+
+    atomic<size_t> next(0);
+    mutex lock;
+    condition_variable ready;     /// a result is in, or one was written
+    size_t written = 0;           /// results the writer took, under lock
+    size_t window = batchAhead * workers;
+
+    vector<thread> pool;
+    for (unsigned int w = 0; w < workers; ++w) {
+        pool.push_back(thread([&]() {
+            unique_ptr<BuildTree> bt;
+            for (size_t i; (i = next.fetch_add(1)) < files.size(); ) {
+                {
+                    unique_lock<mutex> g(lock);
+                    ready.wait(g, [&]() { return i < written + window; });
+                }
+                batch_result_t res;
+                decodeOne(bt, files[i], opts, res);
+
+                lock_guard<mutex> g(lock);
+                results[i].out_.swap(res.out_);
+                results[i].err_.swap(res.err_);
+                results[i].failed_ = res.failed_;
+                results[i].done_ = true;
+                ready.notify_all();
+            }
+        }));
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        batch_result_t res;
+        {
+            unique_lock<mutex> g(lock);
+            ready.wait(g, [&]() { return results[i].done_; });
+            res.out_.swap(results[i].out_);
+            res.err_.swap(results[i].err_);
+            res.failed_ = results[i].failed_;
+            written = i + 1;
+            ready.notify_all();
+        }
+
+        if (res.failed_) {
+            failed++;
+        } else {
+            string head = "==> " + files[i] + " <==\n";
+            if (out.write(head.data(), head.length()) < 0 ||
+                out.write(res.out_.data(), res.out_.length()) < 0)
+                failed++;
+        }
+        reportErrors(err, files[i], res.err_);
+    }
+
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+
+    err.flush();
+    return failed;
+}
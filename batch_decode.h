@@ -0,0 +1,49 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "build_tree.h"
+#include "out_writer.h"
+using namespace std;
+
+#ifndef BATCH_DECODE_H
+#define BATCH_DECODE_H
+
+/**
+ * What every file of a batch is decoded with, the -i/-d/-m/-L/-k/-c/-s
+ * flags of a single file run.
+ */
+typedef struct batch_options
+{
+    bool complete_;
+    bool dupIds_;
+    InputMode mode_;
+    bool large_;
+    uint64_t maxFSize_;           /// only used with large_
+    size_t maxLineSize_;          /// only used with large_
+    bool skipBad_;                /// summary per file, on the error stream
+    bool compact_;
+    Layout layout_;               /// with compact_
+    bool stats_;                  /// JSON per file, on the error stream
+} batch_options_t;
+
+/// One name per line, trimmed of blanks. Blank lines and lines whose first
+/// non-blank is # are skipped.
+int readManifest(const string& fname, vector<string>& files);
+
+/**
+ * Decode files on up to workers threads. Each worker keeps one BuildTree
+ * and reuse()s it, so arenas and the id map are allocated once per worker
+ * rather than once per file.
+ * Results are reported in input order however the decodes finish:
+ *   out:  "==> <file> <==", then the BFS and DFS lines (decoded files only)
+ *   err:  "<file> : <message>" for whatever the decode reported
+ * Returns the number of files that failed.
+ */
+size_t decodeBatch(const vector<string>& files, unsigned int workers,
+                   const batch_options_t& opts, OutputSink& out,
+                   ostream& err);
+
+#endif
@@ -0,0 +1,143 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:generic_bench.cc
+ * BasicBuildTree instantiations on the same shuffled complete tree:
+ * BuildTree itself, 32 and 64 bit ids with text, topology only and a
+ * double per record instead of text. Decode is feed() over the whole
+ * text, then printDFS into a sink that only counts bytes.
+ * usage: generic_bench [node count, default 2M]
+ */
+
+#include "../build_tree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+const long long wideBase = 1LL << 40;     /// 64 bit ids start here
+
+class CountSink : public OutputSink
+{
+public:
+    CountSink() : bytes_(0) {}
+    virtual int write(const char *buf, size_t len)
+    {
+        (void)buf;
+        bytes_ += len;
+        return(0);
+    }
+    size_t bytes_;
+};
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+/// format: 0 text, 1 text with 64 bit ids, 2 a double per record.
+static string
+makeText(const vector<long>& order, long n, int format)
+{
+    string text;
+    char buf[128];
+    long long base = (format == 1 ? wideBase : 0);
+    for (size_t k = 0; k < order.size(); ++k) {
+        long long i = order[k];
+        bool inner = (2 * i + 1 <= n);
+        int len;
+        if (format == 2)
+            len = (inner ?
+                   snprintf(buf, sizeof(buf), "%lld %lld %lld %lld.5\n",
+                            i, 2 * i, 2 * i + 1, i) :
+                   snprintf(buf, sizeof(buf), "%lld %lld.5\n", i, i));
+        else
+            len = (inner ?
+                   snprintf(buf, sizeof(buf), "%lld %lld %lld node-%lld\n",
+                            base + i, base + 2 * i, base + 2 * i + 1, i) :
+                   snprintf(buf, sizeof(buf), "%lld node-%lld\n",
+                            base + i, i));
+        text.append(buf, len);
+    }
+    return text;
+}
+
+template <typename T>
+static void
+run(const char *what, const string& text, size_t node_size)
+{
+    T bt;
+    steady_clock::time_point t0 = steady_clock::now();
+    bt.feed(text.data(), text.size());
+    int ret = bt.finish();
+    double decode_ms = msSince(t0);
+
+    CountSink sink;
+    t0 = steady_clock::now();
+    bt.printDFS(sink);
+    double dfs_ms = msSince(t0);
+    printf("%-16s node %2zu B  decode %8.1f ms  printDFS %7.1f ms"
+           "  (%zu bytes%s)\n", what, node_size, decode_ms, dfs_ms,
+           sink.bytes_, ret < 0 ? ", FAILED" : "");
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1 ? atol(argv[1]) : 2000000);
+    if (n % 2 == 0)
+        n++;
+
+    vector<long> order;
+    for (long i = 2; i <= n; ++i)
+        order.push_back(i);
+    mt19937 rng(1);
+    shuffle(order.begin(), order.end(), rng);
+    order.insert(order.begin(), 1);
+
+    string text = makeText(order, n, 0);
+    string wide = makeText(order, n, 1);
+    string values = makeText(order, n, 2);
+
+    typedef BasicBuildTree<int64_t, text_payload> wideTree_t;
+    typedef BasicBuildTree<int, no_payload> shapeTree_t;
+    typedef BasicBuildTree<int64_t, no_payload> wideShapeTree_t;
+    typedef BasicBuildTree<int, value_payload<double> > valueTree_t;
+
+    run<BuildTree>("BuildTree", text, sizeof(node_t));
+    run<textTree_t>("<int, text>", text, sizeof(textTree_t::Node));
+    run<wideTree_t>("<int64, text>", wide, sizeof(wideTree_t::Node));
+    run<shapeTree_t>("<int, none>", text, sizeof(shapeTree_t::Node));
+    run<wideShapeTree_t>("<int64, none>", wide,
+                         sizeof(wideShapeTree_t::Node));
+    run<valueTree_t>("<int, double>", values, sizeof(valueTree_t::Node));
+    return(0);
+}
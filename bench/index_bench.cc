@@ -0,0 +1,169 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:index_bench.cc
+ * Compares the id index used by BuildTree (FlatIndex) against the
+ * unordered_map<int, list<hash_ref *> *> it replaced.
+ * Replays the decode access pattern for a complete tree written in BFS
+ * order: every line looks up its own id (hit on the placeholder left by
+ * its parent) and inserts a placeholder for each child id (miss).
+ * Runs once with dense ids (1..n) and once with the same tree relabelled
+ * through a random permutation, real dumps rarely number nodes densely.
+ * usage: index_bench [node count, default 10M]
+ */
+
+#include "../build_tree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+typedef list<href_t *> nodeList_t;
+typedef unordered_map<int, nodeList_t *> hashMap_t;
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+static double
+runListMap(const vector<int>& ids, long *checksum)
+{
+    int count = ids.size() - 1;
+    steady_clock::time_point t0 = steady_clock::now();
+    hashMap_t m;
+    for (int id = 1; id <= count; ++id) {
+        hashMap_t::iterator it = m.find(ids[id]);
+        if (it != m.end()) {
+            nodeList_t::iterator lit = it->second->begin();
+            for (; lit != it->second->end(); ++lit) {
+                if ((*lit)->status_ == Status::NONNODE_WAIT) {
+                    (*lit)->status_ = Status::FILLED;
+                    (*checksum)++;
+                    break;
+                }
+            }
+        }
+
+        for (int c = 2 * id; c <= 2 * id + 1 && c <= count; ++c) {
+            href_t *href = new href_t;
+            memset(href, 0, sizeof(href_t));
+            href->status_ = Status::NONNODE_WAIT;
+            nodeList_t *nlist = NULL;
+            it = m.find(ids[c]);
+            if (it != m.end()) {
+                nlist = it->second;
+            } else {
+                nlist = new nodeList_t;
+                m.insert(std::pair<int, nodeList_t *>(ids[c], nlist));
+            }
+            nlist->push_back(href);
+        }
+    }
+    double ms = msSince(t0);
+
+    hashMap_t::iterator it = m.begin();
+    for (; it != m.end(); ++it) {
+        nodeList_t::iterator lit = it->second->begin();
+        for (; lit != it->second->end(); ++lit)
+            delete *lit;
+        delete it->second;
+    }
+    return ms;
+}
+
+static double
+runFlatIndex(const vector<int>& ids, long *checksum)
+{
+    int count = ids.size() - 1;
+    steady_clock::time_point t0 = steady_clock::now();
+    idIndex_t m;
+    for (int id = 1; id <= count; ++id) {
+        idIndex_t::slot *s = m.find(ids[id]);
+        if (s) {
+            for (unsigned int i = 0; i < s->size(); ++i) {
+                if (s->at(i).status_ == Status::NONNODE_WAIT) {
+                    s->at(i).status_ = Status::FILLED;
+                    (*checksum)++;
+                    break;
+                }
+            }
+        }
+
+        for (int c = 2 * id; c <= 2 * id + 1 && c <= count; ++c) {
+            href_t href;
+            memset(&href, 0, sizeof(href_t));
+            href.status_ = Status::NONNODE_WAIT;
+            m.insert(ids[c])->push_back(href);
+        }
+    }
+    return msSince(t0);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 10 * 1000 * 1000;
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (count <= 0) {
+        cerr << "usage: " << argv[0] << " [node count]" << endl;
+        return(-1);
+    }
+
+    vector<int> ids(count + 1);
+    for (int i = 0; i <= count; ++i)
+        ids[i] = i;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            mt19937 rng(42);
+            shuffle(ids.begin() + 1, ids.end(), rng);
+        }
+
+        long list_sum = 0, flat_sum = 0;
+        double list_ms = runListMap(ids, &list_sum);
+        double flat_ms = runFlatIndex(ids, &flat_sum);
+        if (list_sum != flat_sum) {
+            cerr << "mismatch : " << list_sum << " vs " << flat_sum << endl;
+            return(-1);
+        }
+
+        cout << (pass == 0 ? "dense ids" : "random ids")
+             << ", nodes : " << count << endl;
+        cout << "  unordered_map+list : " << list_ms << " ms" << endl;
+        cout << "  FlatIndex          : " << flat_ms << " ms" << endl;
+        cout << "  speedup            : " << list_ms / flat_ms << "x" << endl;
+    }
+    return(0);
+}
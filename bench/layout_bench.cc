@@ -0,0 +1,149 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:layout_bench.cc
+ * Pointer tree against CompactTree in every layout. The input is a
+ * complete tree written with its lines shuffled (root first), so the
+ * pointer tree's nodes sit in the arenas in random order, which is what
+ * real dumps look like. Times printBFS/printDFS into a sink that only
+ * counts bytes, and an in-order walk that only sums ids (shape only,
+ * no descriptions).
+ * usage: layout_bench [node count, default 2M]
+ */
+
+#include "../build_tree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+class CountSink : public OutputSink
+{
+public:
+    CountSink() : bytes_(0) {}
+    virtual int write(const char *buf, size_t len)
+    {
+        (void)buf;
+        bytes_ += len;
+        return(0);
+    }
+    size_t bytes_;
+};
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+static void
+report(const char *what, const BuildTree& bt, long sum, double walk_ms)
+{
+    CountSink bfs, dfs;
+    steady_clock::time_point t0 = steady_clock::now();
+    bt.printBFS(bfs);
+    double bfs_ms = msSince(t0);
+    t0 = steady_clock::now();
+    bt.printDFS(dfs);
+    double dfs_ms = msSince(t0);
+    printf("%-9s printBFS %8.1f ms  printDFS %8.1f ms  id walk %8.1f ms"
+           " (%zu bytes, sum %ld)\n",
+           what, bfs_ms, dfs_ms, walk_ms, bfs.bytes_ + dfs.bytes_, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1 ? atol(argv[1]) : 2000000);
+    if (n % 2 == 0)
+        n++;
+
+    vector<long> order;
+    for (long i = 2; i <= n; ++i)
+        order.push_back(i);
+    mt19937 rng(1);
+    shuffle(order.begin(), order.end(), rng);
+    order.insert(order.begin(), 1);
+
+    string text;
+    char buf[96];
+    for (size_t k = 0; k < order.size(); ++k) {
+        long i = order[k];
+        int len = (2 * i + 1 <= n ?
+                   snprintf(buf, sizeof(buf), "%ld %ld %ld node-%ld\n",
+                            i, 2 * i, 2 * i + 1, i) :
+                   snprintf(buf, sizeof(buf), "%ld node-%ld\n", i, i));
+        text.append(buf, len);
+    }
+
+    BuildTree bt;
+    bt.feed(text.data(), text.size());
+    if (bt.finish() < 0)
+        return(-1);
+    bt.prepareQuery();
+
+    // pointer tree, in-order through the iterator printDFS uses.
+    steady_clock::time_point t0 = steady_clock::now();
+    long sum = 0;
+    InOrderIter<node_t> it(bt.query().node(0));
+    for (const node_t *t; (t = it.next()) != NULL; )
+        sum += t->id_;
+    report("pointer", bt, sum, msSince(t0));
+
+    const char *names[] = { "bfs", "preorder", "veb" };
+    Layout layouts[] = { Layout::BFS, Layout::PREORDER, Layout::VEB };
+    for (int l = 0; l < 3; ++l) {
+        t0 = steady_clock::now();
+        bt.compact(layouts[l]);
+        double build_ms = msSince(t0);
+
+        CompactTree ct;
+        ct.build(bt.query().node(0), layouts[l]);
+        t0 = steady_clock::now();
+        sum = 0;
+        vector<uint32_t> stack;
+        uint32_t cur = ct.root();
+        while (cur != compactNone || !stack.empty()) {
+            while (cur != compactNone) {
+                stack.push_back(cur);
+                cur = ct.left(cur);
+            }
+            cur = stack.back();
+            stack.pop_back();
+            sum += ct.id(cur);
+            cur = ct.right(cur);
+        }
+        double walk_ms = msSince(t0);
+        report(names[l], bt, sum, walk_ms);
+        printf("%-9s (build %.1f ms)\n", "", build_ms);
+    }
+    return(0);
+}
@@ -0,0 +1,170 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:print_bench.cc
+ * printBFS/printDFS with 1, 2, 4 and 8 print threads on a shuffled
+ * complete tree, a random shaped one and a caterpillar, every run is
+ * checked byte for byte against the serial output.
+ * usage: print_bench [node count, default 2M]
+ */
+
+#include "../build_tree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+/// Complete tree, lines shuffled with the root first.
+static void
+completeTree(long n, string& text)
+{
+    vector<long> order;
+    for (long i = 2; i <= n; ++i)
+        order.push_back(i);
+    mt19937 rng(1);
+    shuffle(order.begin(), order.end(), rng);
+    order.insert(order.begin(), 1);
+
+    char buf[96];
+    for (size_t k = 0; k < order.size(); ++k) {
+        long i = order[k];
+        int len = (2 * i + 1 <= n ?
+                   snprintf(buf, sizeof(buf), "%ld %ld %ld node-%ld\n",
+                            i, 2 * i, 2 * i + 1, i) :
+                   snprintf(buf, sizeof(buf), "%ld node-%ld\n", i, i));
+        text.append(buf, len);
+    }
+}
+
+/// Every node hangs off a random free child slot, so subtrees are
+/// lopsided. Only ever two or no children so -i is not needed.
+static void
+randomTree(long n, string& text)
+{
+    mt19937 rng(2);
+    vector<long> leaves(1, 1);
+    vector<pair<long, long> > kids(n + 1, make_pair(0L, 0L));
+    for (long i = 2; i + 1 <= n; i += 2) {
+        size_t k = rng() % leaves.size();
+        long p = leaves[k];
+        leaves[k] = i;
+        leaves.push_back(i + 1);
+        kids[p] = make_pair(i, i + 1);
+    }
+
+    char buf[96];
+    for (long i = 1; i <= n; ++i) {
+        int len = (kids[i].first ?
+                   snprintf(buf, sizeof(buf), "%ld %ld %ld node-%ld\n",
+                            i, kids[i].first, kids[i].second, i) :
+                   snprintf(buf, sizeof(buf), "%ld node-%ld\n", i, i));
+        text.append(buf, len);
+    }
+}
+
+/// A spine with a leaf hanging off every spine node, the spine turns
+/// left or right at random. Never wider than two, so printDFS() splits
+/// it with two threads and prints it serially with more.
+static void
+caterpillarTree(long n, string& text)
+{
+    mt19937 rng(3);
+    char buf[96];
+    long i = 1;
+    for (; i + 2 <= n; i += 2) {
+        bool left = (rng() % 2 == 0);        // where the spine goes on
+        int len = snprintf(buf, sizeof(buf), "%ld %ld %ld node-%ld\n", i,
+                           left ? i + 2 : i + 1, left ? i + 1 : i + 2, i);
+        text.append(buf, len);
+        len = snprintf(buf, sizeof(buf), "%ld node-%ld\n", i + 1, i + 1);
+        text.append(buf, len);
+    }
+    int len = snprintf(buf, sizeof(buf), "%ld node-%ld\n", i, i);
+    text.append(buf, len);
+}
+
+static int
+run(const char *what, const string& text)
+{
+    BuildTree bt;
+    bt.feed(text.data(), text.size());
+    if (bt.finish() < 0)
+        return(-1);
+
+    StringSink bfs1, dfs1;
+    unsigned int threads[] = { 1, 2, 4, 8 };
+    for (int k = 0; k < 4; ++k) {
+        StringSink bfs, dfs;
+        bt.setPrintThreads(threads[k]);
+        steady_clock::time_point t0 = steady_clock::now();
+        bt.printBFS(k == 0 ? bfs1 : bfs);
+        double bfs_ms = msSince(t0);
+        t0 = steady_clock::now();
+        bt.printDFS(k == 0 ? dfs1 : dfs);
+        double dfs_ms = msSince(t0);
+
+        bool same = (k == 0 || (bfs.str() == bfs1.str() &&
+                                dfs.str() == dfs1.str()));
+        printf("%-8s threads %u  printBFS %8.1f ms  printDFS %8.1f ms%s\n",
+               what, threads[k], bfs_ms, dfs_ms,
+               same ? "" : "  OUTPUT DIFFERS");
+        if (!same)
+            return(-1);
+    }
+    return(0);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1 ? atol(argv[1]) : 2000000);
+    if (n % 2 == 0)
+        n++;
+
+    string text;
+    completeTree(n, text);
+    if (run("complete", text) < 0)
+        return(-1);
+
+    text.clear();
+    randomTree(n, text);
+    if (run("random", text) < 0)
+        return(-1);
+
+    text.clear();
+    caterpillarTree(n, text);
+    return (run("caterpil", text) < 0 ? -1 : 0);
+}
@@ -0,0 +1,190 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:publish_bench.cc
+ * TreePublisher under load: readers pin the current tree and print it
+ * and answer lca queries over and over, while a writer decodes new
+ * versions (two different texts, alternating) and publishes them.
+ * Every read has to match one version completely, and replaced trees
+ * have to be freed while the readers are still going.
+ * usage: publish_bench [node count, default 200K] [readers, default 4]
+ *                      [versions, default 16]
+ */
+
+#include "../build_tree.h"
+#include "../tree_publish.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+/// Complete tree, descriptions tagged so the two versions differ.
+static void
+completeTree(long n, const char *tag, string& text)
+{
+    char buf[96];
+    for (long i = 1; i <= n; ++i) {
+        int len = (2 * i + 1 <= n ?
+                   snprintf(buf, sizeof(buf), "%ld %ld %ld %s-%ld\n",
+                            i, 2 * i, 2 * i + 1, tag, i) :
+                   snprintf(buf, sizeof(buf), "%ld %s-%ld\n", i, tag, i));
+        text.append(buf, len);
+    }
+}
+
+static unique_ptr<BuildTree>
+decode(const string& text)
+{
+    unique_ptr<BuildTree> bt(new BuildTree);
+    bt->feed(text.data(), text.size());
+    if (bt->finish() < 0 || bt->prepareQuery(true) < 0)
+        return unique_ptr<BuildTree>();
+    bt->enableStats(true);        /// printers time themselves, shared.
+    return bt;
+}
+
+typedef struct expected
+{
+    string bfs_;
+    string dfs_;
+    vector<int> lcaIds_;          /// per query, by id
+    vector<uint32_t> dist_;
+} expected_t;
+
+static void
+answer(const BuildTree& bt, const vector<lca_query_t>& queries,
+       expected_t& e)
+{
+    StringSink bfs, dfs;
+    bt.printBFS(bfs);
+    bt.printDFS(dfs);
+    e.bfs_.swap(bfs.str());
+    e.dfs_.swap(dfs.str());
+
+    vector<lca_answer_t> answers;
+    bt.query().lcaBatch(queries, answers, 2);
+    e.lcaIds_.clear();
+    e.dist_.clear();
+    for (size_t i = 0; i < answers.size(); ++i) {
+        e.lcaIds_.push_back(answers[i].lca_ == queryNone ? -1 :
+                            bt.query().id(answers[i].lca_));
+        e.dist_.push_back(answers[i].dist_);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long n = (argc > 1 ? atol(argv[1]) : 200000);
+    int readers = (argc > 2 ? atoi(argv[2]) : 4);
+    int versions = (argc > 3 ? atoi(argv[3]) : 16);
+    if (n % 2 == 0)
+        n++;
+
+    string text[2];
+    completeTree(n, "even", text[0]);
+    completeTree(n, "odd", text[1]);
+
+    vector<lca_query_t> queries;
+    for (long i = 0; i < 256; ++i) {
+        lca_query_t q = { (int)(1 + (i * 7919) % n),
+                          (int)(1 + (i * 104729) % n) };
+        queries.push_back(q);
+    }
+
+    expected_t want[2];
+    for (int v = 0; v < 2; ++v) {
+        unique_ptr<BuildTree> bt = decode(text[v]);
+        if (!bt) {
+            printf("decode failed\n");
+            return(-1);
+        }
+        answer(*bt, queries, want[v]);
+    }
+
+    TreePublisher pub;
+    atomic<bool> done(false);
+    atomic<uint64_t> reads(0);
+    atomic<uint64_t> bad(0);
+    vector<thread> pool;
+    for (int r = 0; r < readers; ++r) {
+        pool.push_back(thread([&]() {
+            expected_t got;
+            while (!done) {
+                TreePublisher::Reader pin(pub);
+                if (!pin.tree()) {
+                    this_thread::yield();
+                    continue;
+                }
+                answer(*pin.tree(), queries, got);
+                bool ok = false;
+                for (int v = 0; v < 2; ++v) {
+                    ok = ok || (got.bfs_ == want[v].bfs_ &&
+                                got.dfs_ == want[v].dfs_ &&
+                                got.lcaIds_ == want[v].lcaIds_ &&
+                                got.dist_ == want[v].dist_);
+                }
+                if (!ok)
+                    bad++;
+                reads++;
+            }
+        }));
+    }
+
+    // readers run all along, so whatever is freed is freed under them.
+    size_t freed = 0;
+    size_t waiting = 0;
+    steady_clock::time_point t0 = steady_clock::now();
+    for (int v = 0; v < versions; ++v) {
+        unique_ptr<BuildTree> bt = decode(text[v % 2]);
+        if (!bt) {
+            printf("decode failed\n");
+            done = true;
+            break;
+        }
+        pub.publish(move(bt));
+        waiting = pub.reclaim();
+        freed = v - waiting;      /// every version but the current one
+    }
+    while (reads < (uint64_t)readers * 2)
+        this_thread::yield();
+    done = true;
+    for (size_t r = 0; r < pool.size(); ++r)
+        pool[r].join();
+    double ms = duration_cast<microseconds>(steady_clock::now() -
+                                            t0).count() / 1e3;
+
+    printf("nodes %ld readers %d versions %d  %.1f ms  reads %llu "
+           "mismatched %llu  freed under readers %zu waiting %zu\n",
+           n, readers, versions, ms, (unsigned long long)reads.load(),
+           (unsigned long long)bad.load(), freed, waiting);
+    return ((bad == 0 && freed > 0) ? 0 : -1);
+}
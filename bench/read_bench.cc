@@ -0,0 +1,125 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:read_bench.cc
+ * Reads a file start to end through read(2) and through ReadAhead with
+ * either backend, and with a busy loop standing in for the parser so
+ * the overlap shows. Prints MB/s and a checksum per run, the checksums
+ * must agree.
+ * usage: read_bench <file> [ns of work per KB, default 0]
+ */
+
+#include "../read_ahead.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+const size_t blockSize = 1024 * 1024;
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+/// Stand in for parsing: sum the bytes, then spin ns per KB.
+static uint64_t
+work(const char *buf, size_t len, long ns_per_kb)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum = sum * 31 + (unsigned char)buf[i];
+    if (ns_per_kb > 0) {
+        steady_clock::time_point until = steady_clock::now() +
+            nanoseconds(ns_per_kb * (long)(len / 1024));
+        while (steady_clock::now() < until)
+            ;
+    }
+    return sum;
+}
+
+static void
+report(const char *name, uint64_t bytes, double ms, uint64_t sum)
+{
+    printf("%-8s %8.1f ms %8.1f MB/s  sum %016llx\n", name, ms,
+           bytes / (1024.0 * 1024.0) / (ms / 1000.0),
+           (unsigned long long)sum);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <file> [ns per KB]" << endl;
+        return(-1);
+    }
+    string fname(argv[1]);
+    long ns_per_kb = (argc > 2 ? atol(argv[2]) : 0);
+
+    {
+        int fd = open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << fname << " : error in open" << endl;
+            return(-1);
+        }
+        vector<char> buf(blockSize);
+        uint64_t sum = 0, bytes = 0;
+        steady_clock::time_point t0 = steady_clock::now();
+        for (ssize_t n; (n = read(fd, &buf[0], buf.size())) > 0; ) {
+            sum += work(&buf[0], n, ns_per_kb);
+            bytes += n;
+        }
+        report("read", bytes, msSince(t0), sum);
+        close(fd);
+    }
+
+    ReadBackend backends[] = { ReadBackend::PREAD, ReadBackend::URING };
+    for (int i = 0; i < 2; ++i) {
+        ReadAhead ra(blockSize, 4, backends[i]);
+        steady_clock::time_point t0 = steady_clock::now();
+        if (ra.open(fname) < 0)
+            return(-1);
+
+        uint64_t sum = 0, bytes = 0;
+        const char *buf;
+        size_t len;
+        int ret;
+        while ((ret = ra.next(&buf, &len)) > 0) {
+            sum += work(buf, len, ns_per_kb);
+            bytes += len;
+        }
+        if (ret < 0)
+            return(-1);
+        report(ra.backend() == ReadBackend::URING ? "uring" : "pread",
+               bytes, msSince(t0), sum);
+    }
+    return(0);
+}
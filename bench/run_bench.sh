@@ -0,0 +1,68 @@
+#!/bin/sh
+# -*- sh -*-
+#
+# Decode benchmark over synthetic trees, run by "make bench".
+#   run_bench.sh <decode_tree> <gen_tree> [nodes]
+# Inputs are generated once into $BENCH_DIR (default /tmp/decode_bench)
+# and reused while their size matches. Every shape is decoded with the
+# stream, mmap and parallel (-t $BENCH_THREADS -p) readers, the traversal
+# output goes to /dev/null. Phase times and peak RSS come from -s.
+
+DECODE=${1:?decode_tree binary}
+GEN=${2:?gen_tree binary}
+NODES=${3:-1000000}
+DIR=${BENCH_DIR:-/tmp/decode_bench}
+THREADS=${BENCH_THREADS:-$(nproc 2>/dev/null || echo 2)}
+[ "$THREADS" -ge 2 ] || THREADS=2     # -t 1 is the serial mmap reader
+
+mkdir -p "$DIR" || exit 1
+
+# key from the one line JSON decode_tree -s prints.
+jget() {
+    sed -n "s/.*\"$1\":\([-0-9.e+]*\).*/\1/p" "$2"
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+printf "%-11s %-6s %10s %9s %9s %9s %9s %12s %10s\n" \
+    shape mode nodes parse_ms stitch_ms trav_ms wall_ms nodes/sec rss_kb
+
+for shape in balanced leftchain rightchain shuffled dupforest incomplete; do
+    input="$DIR/$shape-$NODES.txt"
+    if [ ! -s "$input" ]; then
+        "$GEN" -s $shape -n "$NODES" -o "$input" || exit 1
+    fi
+
+    case $shape in
+    dupforest) flags="-d" ;;
+    incomplete) flags="-i" ;;
+    *) flags="" ;;
+    esac
+
+    for mode in stream mmap par; do
+        case $mode in
+        stream) mflags="" ;;
+        mmap) mflags="-m" ;;
+        par) mflags="-t $THREADS -p" ;;
+        esac
+
+        stats="$DIR/stats.json"
+        start=$(now_ms)
+        if ! "$DECODE" -s $flags $mflags -f "$input" \
+            > /dev/null 2> "$stats"; then
+            printf "%-11s %-6s failed: %s\n" $shape $mode "$(head -1 $stats)"
+            continue
+        fi
+        wall=$(( $(now_ms) - start ))
+        [ $wall -gt 0 ] || wall=1
+
+        lines=$(jget lines "$stats")
+        printf "%-11s %-6s %10s %9.1f %9.1f %9.1f %9d %12d %10s\n" \
+            $shape $mode $lines \
+            $(jget parseMs "$stats") $(jget stitchMs "$stats") \
+            $(jget traverseMs "$stats") $wall \
+            $(( lines * 1000 / wall )) $(jget maxRssKb "$stats")
+    done
+done
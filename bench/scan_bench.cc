@@ -0,0 +1,86 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:scan_bench.cc
+ * Line splitting and tokenizing throughput of simd_scan.cc at every
+ * SIMD level this CPU has, over a generated file in the decode_tree
+ * format (a BFS numbered complete tree, short descriptions).
+ * usage: scan_bench [line count, default 5M]
+ */
+
+#include "../simd_scan.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+
+static double
+msSince(const steady_clock::time_point& t0)
+{
+    return duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    long lines = (argc > 1 ? atol(argv[1]) : 5000000);
+    string text;
+    text.reserve(lines * 24);
+    char buf[64];
+    for (long i = 1; i <= lines; ++i) {
+        int len = (2 * i + 1 <= lines ?
+                   snprintf(buf, sizeof(buf), "%ld %ld %ld node-%ld\n",
+                            i, 2 * i, 2 * i + 1, i) :
+                   snprintf(buf, sizeof(buf), "%ld node-%ld\n", i, i));
+        text.append(buf, len);
+    }
+
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    int top = (int)simdLevel();
+    for (int lv = 0; lv <= top; ++lv) {
+        setSimdLevel((SimdLevel)lv);
+        steady_clock::time_point t0 = steady_clock::now();
+        long sum = 0, count = 0;
+        line_head_t h;
+        for (const char *p = begin; p < end; ) {
+            const char *nl = findNewline(p, end);
+            scanHead(p, nl - p, &h);
+            for (unsigned int k = 0; k < h.count_; ++k)
+                sum += h.vals_[k];
+            count++;
+            p = (nl < end ? nl + 1 : end);
+        }
+        double ms = msSince(t0);
+        cout << simdLevelName((SimdLevel)lv) << " : " << count << " lines "
+             << ms << " ms " << (long)(text.size() / ms / 1e3) << " MB/s"
+             << " (sum " << sum << ")" << endl;
+    }
+    return(0);
+}
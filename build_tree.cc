@@ -25,62 +25,36 @@
 /**
  * @file:build_tree.cc
  * Implementation for decoding a tree from encoded text file.
- * Uses HashMap to get O(1) insert into the tree since the assumption is
- * any number of lines have to processed.
- * Few things are unclear hence following options have been provided.
- * -d : support duplicate node_ids (look into test_cycle/)
- * -i : support incomplete trees  (look into test_completeonly/)
+ * The decode itself (HashMap stitching, -d, -i, feed()) is the
+ * BasicBuildTree<int, text_payload> in basic_build_tree.h, this file adds
+ * what BuildTree keeps next to the tree: worker arenas of the parallel
+ * decode, the snapshot, the query index and the compact copy.
  */
 
 #include "build_tree.h"
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
-#include <errno.h>
-#include <istream>
 #include <iostream>
-#include <sstream>
-#include <vector>
-#include <array>
-#include <queue>
 
-// #define NDEBUG
-#include <cassert>
 using namespace std;
 
-const unsigned int maxFSize = 100*1024*1024; /// in Bytes, 100Mb default
-const unsigned int maxLineSize = 1024;       /// in Char count
-
 /**
  * Constructor
  */
 BuildTree::BuildTree()
-    : decodedTree_(NULL),
-      wait_count_(0),
-      maxFSize_(maxFSize),
-      complete_tree_(true),
-      duplicate_ids_(false)
+    : threads_(1),
+      sharded_(false)
 {
 }
 
 /**
  * Constructor with options!.
  */
-BuildTree::BuildTree(string& fname, bool complete_tree, bool dup_ids)
-    : decodedTree_(NULL),
-      wait_count_(0),
-      maxFSize_(maxFSize),
-      complete_tree_(complete_tree),
-      duplicate_ids_(dup_ids)
+BuildTree::BuildTree(const string& fname, bool complete_tree, bool dup_ids)
+    : textTree_t(fname, complete_tree, dup_ids),
+      threads_(1),
+      sharded_(false)
 {
-    if (fname.length() == 0)
-    {
-        cerr << "Invalid fname" << endl;
-        return;
-    }
-
-    fname_ = fname;
 }
 
 /**
@@ -88,553 +62,190 @@ BuildTree::BuildTree(string& fname, bool complete_tree, bool dup_ids)
  */
 BuildTree::~BuildTree()
 {
-    if (inFile_.is_open())
-    {
-        inFile_.close();
-    }
-
     decomission();
 }
 
 /**
  * Call to delete the allocated HashMap and the decoded tree.
+ * Nodes and descriptions live in the arenas so the tree goes in one shot.
  */
 void
 BuildTree::decomission()
 {
-    hashMap_t::iterator it = insertMap_.begin();
-    for (; it != insertMap_.end(); ++it) {
-        nodeList_t& node_list = *it->second;
-        nodeList_t::iterator lit = node_list.begin();
-        for (; lit != node_list.end(); ++lit) {
-            href_t* ln = *lit;
-            if (ln->status_ == Status::NODE_WAIT)
-            {
-                node_t *t = (node_t *)ln->nodePtr_;
-                freeN(t);
-            }
-            delete ln;
-        }
-        delete &node_list;
-    }
-    insertMap_.clear();
-
-    if (!decodedTree_)
-        return;
+    clearTree(false);
+    query_.clear();
+    compact_.clear();
+    workerNodes_.clear();
+    workerDescrs_.clear();
+    return;
+}
 
-    queue<node_t *> q;
-    q.push(decodedTree_);
+/**
+ * Like decomission() but slabs, string blocks and the id map keep their
+ * memory, a batch of files decodes without going back to the allocator.
+ */
+void
+BuildTree::reuse(const string& fname)
+{
+    if (inFile_.is_open())
+        inFile_.close();
+    inFile_.clear();
+    mapped_.close();
+    snap_.close();
+
+    clearTree(true);
+    query_.clear();
+    compact_.clear();
+    workerNodes_.clear();         /// decodeParallel() appends its own.
+    workerDescrs_.clear();
+
+    memset(&stats_, 0, sizeof(stats_));
+    traverseNs_.store(0);
+    fname_ = fname;
+}
 
-    while (q.size() != 0) {
-        node_t *t = q.front();
-        q.pop();
-        if (t->left_)
-            q.push(t->left_);
-        if (t->right_)
-            q.push(t->right_);
-        if (t->descr_) {
-            delete t->descr_;
-            t->descr_ = NULL;
-        }
-        delete t;
-    }
-    return;
+void
+BuildTree::setThreads(const unsigned int threads)
+{
+    threads_ = (threads == 0 ? 1 : threads);
+    setPrintThreads(threads_);
 }
 
 void
-BuildTree::setMaxFileSize(const unsigned int fsize)
+BuildTree::setShardedStitch(const bool sharded)
 {
-    maxFSize_ = fsize;
+    sharded_ = sharded;
 }
 
 /**
- * Helps with stopping bad filenames and files that exceed the limit
- * we expect.
+ * Nodes of the parser threads count too.
  */
-int
-BuildTree::fileCheck(const string& fname)
+decode_stats_t
+BuildTree::stats() const
 {
-    struct stat sbuf;
-    memset(&sbuf, 0, sizeof(sbuf));
-    if (::stat(fname.c_str(), &sbuf) == -1) {
-        cerr << "stat Error for fname : " << fname << " "
-             << strerror(errno) << endl;
-        return(-1);
-    }
-
-    if (!S_ISREG(sbuf.st_mode)) {
-        cerr << "fname : " << fname
-             << " is not a regular file" << endl;
-        return(-1);
-    }
-
-    if (sbuf.st_size > maxFSize_) {
-        cerr << "fname : " << fname
-             << " size : " << sbuf.st_size
-             << " exceeded max size : " << maxFSize_ << endl;
-        return(-1);
-    }
-    return 0;
+    decode_stats_t st = textTree_t::stats();
+    for (size_t w = 0; w < workerNodes_.size(); ++w)
+        st.nodes_ += workerNodes_[w]->size();
+    return st;
 }
 
 /**
- * Insert a new node into the hashMap, here except for the first time
- * rest of the nodes will reside in either NODE_WAIT(with description)
- * and NONNODE_WAIT (leaves waiting for nodes with description)
- * This along with checkHashMap helps with O(1) inserts for the
- * tree.
+ * Main method that interfaces external world. Use this to start
+ * decoding. -t goes to the parallel decode, everything else to the
+ * serial one.
  */
-int
-BuildTree::insertHashMap(node_t &n, node_t **holder, Status s)
+int BuildTree::decodeFile()
 {
-    // first time.
-    href_t *href = new href_t;
-    memset(href, 0, sizeof(href_t));
-    href->nodePtr_ = holder;
+    if (threads_ <= 1 || mode_ == InputMode::ASYNC || large_)
+        return textTree_t::decodeFile();
 
-    if (insertMap_.empty()) {
-        // first insert set the root.
-        decodedTree_ = &n;
-        href->nodePtr_ = &decodedTree_;
-        s = Status::FILLED;
-    }
-
-    nodeList_t *nlist = NULL;
-    hashMap_t::iterator it = insertMap_.find(n.id_);
-    if (it != insertMap_.end()) {
-        nlist = it->second;
-    } else {
-        nlist = new nodeList_t;
-        std::pair<int, nodeList_t *>ins_item(n.id_, nlist);
-        insertMap_.insert(ins_item);
-    }
+    if (fileCheck(fname_) < 0)
+        return -1;
+    // the parsers work on the mapped text, nothing to map here.
+    if (codec_ != Codec::NONE)
+        return decodeCompressed();
 
-    if (s == Status::NODE_WAIT) {
-        href->nodePtr_ = (node_t **)&n; ///XXX: Hack :(
-    }
+    int ret = (sharded_ ? decodeSharded() : decodeParallel());
+    if (ret < 0)
+        return(-1);
 
-    if (s != Status::FILLED)
-    {
-        wait_count_++;
-    }
-    href->status_ = s;
-    nlist->push_back(href);
-    return(0);
+    settleSkipped();
+    return checkDecoded();
 }
 
 /**
- * Helps with reducing wait_count when root gets shifted.
+ * The query index is built from the finished tree rather than taken over
+ * from insertMap_, whose refs point at holders and which is empty after a
+ * sharded decode (and pruned in large input mode).
  */
 int
-BuildTree::markParentFilled(node_t *n)
+BuildTree::prepareQuery(const bool lca)
 {
-    hashMap_t::iterator it = insertMap_.find(n->id_);
-    if (it == insertMap_.end())
+    if (!decodedTree_) {
+        *err_ << "prepareQuery: no decoded tree" << endl;
         return(-1);
-
-     nodeList_t& node_list = *it->second;
-     nodeList_t::iterator lit = node_list.begin();
-     for (; lit != node_list.end(); ++lit) {
-         href_t* ln = *lit;
-         if (ln->status_ == Status::NODE_WAIT)
-         {
-             ln->status_ = Status::FILLED;
-             wait_count_--;
-             return(0);
-         }
-     }
-
-     return(-1);
+    }
+    if (query_.build(decodedTree_) < 0)
+        return(-1);
+    return (lca ? query_.prepareLca() : 0);
 }
 
-/**
- * Main method for stiching disjoint trees together as more info
- * comes in.
- * Using a list of nodes in the HashMap to help us support same integer
- * used in many nodes.
- */
 int
-BuildTree::checkHashMap(node_t *n, node_t** holder, node_t *parent)
+BuildTree::compact(const Layout layout)
 {
-    hashMap_t::iterator it = insertMap_.find(n->id_);
-    if (it != insertMap_.end()) {
-        // found something.
-        nodeList_t& node_list = *it->second;
-        nodeList_t::iterator lit = node_list.begin();
-        bool is_filled = false;
-        for (; lit != node_list.end(); ++lit) {
-            href_t* ln = *lit;
-            // hit, check if this in wait state.
-            if (ln->status_ == Status::FILLED &&
-                ln->nodePtr_ != &decodedTree_)
-                continue; // not interesting spoken for.
-
-            // this is wait state.
-            // lets insert this into the tree and mark it as filled.
-
-            /* two cases here.
-             * 1. non node found a node.
-             * 2. node found a non node.
-             */
-
-            switch(ln->status_) {
-            case Status::NODE_WAIT: {
-                // check we are not asked to handle an unfilled node.
-                if (n->descr_ != NULL || holder == NULL) {
-                    if (duplicate_ids_) {
-                        return(-1);
-                    }
-
-                    cerr << "NODE_WAIT: " << n->descr_
-                         << " : found for node_id "
-                         << n->id_ << endl;
-                    return -EINVAL;
-                }
-
-                delete n;
-                node_t *tn = (node_t *)ln->nodePtr_;
-                *holder = tn;
-                ln->nodePtr_ = holder;
-                wait_count_--;
-                break;
-            }
-            case Status::NONNODE_WAIT: {
-                // check we have a node
-                if (n->descr_ == NULL) {
-                    if (duplicate_ids_) {
-                        return(-1);
-                    }
-                    cerr << "NONENODE_WAIT: " << n->id_ << endl;
-                    return -EINVAL;
-                }
-
-                node_t *tfree = *ln->nodePtr_;
-                *ln->nodePtr_ = n;
-                delete tfree;
-                wait_count_--;
-                break;
-            }
-            case Status::FILLED: {
-                // This is only possible if ln is pointed by root so adjust
-                // the root.
-                if (n->descr_ != NULL) {
-                    // if we are replacing root then we better be a
-                    // non node.
-                    cerr << "FILLED: " << n->descr_
-                         << " : descr found for node_id "
-                         << n->id_ << endl;
-                    return -EINVAL;
-                }
-
-                if (!parent) {
-                    // if we are taking ownership of root then we better
-                    // have one.
-                    cerr << "PARENT: not found for node_id "
-                         << n->id_ << endl;
-                    return -EINVAL;
-                }
-
-                delete n;
-                *holder = *ln->nodePtr_; // lets take current root.
-                decodedTree_ = parent; // point to new root.
-
-                if (markParentFilled(parent) < 0) {
-                    cerr << "Could not mark FILLED for parent : "
-                         << parent->id_ << endl;
-                    return -EINVAL;
-                }
-
-                break;
-            }
-            default:
-                cerr << "node status is : " << (int)ln->status_ << endl;
-                assert(false);
-            }
-
-            ln->status_ = Status::FILLED;
-            is_filled = true;
-            break;
-        }
-
-        if (!is_filled) {
-            if (duplicate_ids_) {
-                return(-1);
-            }
-
-            cerr << "node not filled : " << n->id_ << endl;
-            return(-EINVAL);
-        }
-
-        return(0);
+    if (!decodedTree_) {
+        *err_ << "compact: no decoded tree" << endl;
+        return(-1);
     }
+    return compact_.build(decodedTree_, layout);
+}
 
-    return(-1); // not found
+int
+BuildTree::saveSnapshot(const string& fname) const
+{
+    return writeSnapshot(fname, decodedTree_);
 }
 
 /**
- * Consume each node and place at the right place in the tree
- * or store it for future use.
+ * Drop whatever we decoded and serve the traversals off the snapshot.
  */
 int
-BuildTree::processNode(node_t *n, node_t **holder, node_t *parent)
+BuildTree::loadSnapshot(const string& fname)
 {
-    // first check if we have an existing entry for n->id_ in this.
-    int ret = checkHashMap(n, holder, parent);
-
-    Status s = Status::FILLED;
-    if (ret < 0) { // not found.
-        if (ret == -EINVAL)
-            return(ret);
-
-        s = Status::NODE_WAIT;
-        if (n->descr_ == NULL) {
-            s = Status::NONNODE_WAIT;
-        }
-
-        insertHashMap(*n, holder, s);
-   }
-
-    // now try the left and right.
-    if (n->left_) {
-        ret = processNode(n->left_, &n->left_, n);
-        if (ret == -EINVAL) {
-            return(ret);
-        }
-    }
-
-    if (n->right_) {
-        ret = processNode(n->right_, &n->right_, n);
-        if (ret == -EINVAL) {
-            return(ret);
-        }
-    }
-
-    return(0);
+    decomission();
+    return snap_.open(fname);
 }
 
 /**
- * Parse each line, tried to use some c++ specific stuff instead of plain
- * C-Style parsing. C-Style parsing could avoid extra copies
- * Will return a node left and right child if present.
+ * Default output goes to stdout, cout is flushed first so anything the
+ * caller wrote there stays in order.
  */
-node_t *
-BuildTree::parseLine(shared_ptr<string> line)
+void
+BuildTree::printBFS() const
 {
-    if (line->length() >= maxLineSize) {
-        cerr << "exceeded size : " << maxLineSize << endl;
-        return NULL;
-    }
-
-    node_t *n = NULL;
-    istringstream in_line(*line);
-    in_line.seekg(0, in_line.end);
-    unsigned int end_pos = in_line.tellg();
-    in_line.seekg(0, in_line.beg);
-    int c = 0; (void)c;
-    bool firstData = false; // did we get through the first item?
-    int leaf_count = 0;
-    for (array<char, maxLineSize> a;
-         in_line.getline(&a[0], maxLineSize, ' '); ) {
-        bool set_descr = false;
-        int node_id = 0;
-        if (strlen(&a[0]) == 0 || a[0] == ' ') {
-            continue;
-        }
-
-        int sval = sscanf(&a[0], "%d", &node_id);
-
-        if (!firstData) {
-            if (!sval) {
-                cerr << "Cannot parse line" << endl;
-                return NULL;
-            }
-
-            n = new node_t;
-            memset(n, 0, sizeof(node_t));
-            n->id_ = node_id;
-            firstData = true;
-            continue;
-        }
-
-        if (sval) {
-            node_t **item = (n->left_ != NULL ? &n->right_ : &n->left_);
-            if (*item != NULL) {
-                // both are taken care of so add this to description
-                set_descr = true;
-            } else {
-                *item = new node_t;
-                memset(*item, 0, sizeof(node_t));
-                (*item)->id_ = node_id;
-                leaf_count++;
-            }
-        }
-
-        // subsequent data.
-        if (!sval || set_descr) {
-            // if we only support complete tree then add the left node to
-            // description.
-            // this word is not a number
-            // lets store the current position in the stream and
-            // rewind and store description and bail.
-            array<char, maxLineSize> *buf = new array<char, maxLineSize>;
-            memset(&(*buf)[0], 0, maxLineSize);
-
-            int offset = 0;
-            if (complete_tree_ && leaf_count == 1) {
-                // fold the leaf id into the description.
-                sprintf(&(*buf)[0], "%d ", n->left_->id_);
-                delete n->left_;
-                n->left_ = NULL;
-                offset = strlen(&(*buf)[0]);
-            }
-
-            memcpy(&(*buf)[offset], &a[0], strlen(&a[0]));
-
-            if (in_line.eof()) {
-                n->descr_ = &(*buf)[0];
-                break;
-            }
-
-            char *buf_fwd = &(*buf)[offset] + strlen(&a[0]);
-            *buf_fwd = ' ';
-            unsigned int cur_pos = in_line.tellg();
-
-            in_line.seekg(cur_pos, ios_base::beg);
-            in_line.read(++buf_fwd, end_pos - cur_pos);
-            n->descr_ = &(*buf)[0];
-            break;
-        }
-    }
-
-    if (n->descr_ == NULL) {
-        // user did not entry anything but we need a dummy value cannt manage
-        // null pointer for this field.
-        array<char, 1> *buf = new array<char, 1>;
-        memset(&(*buf)[0], 0, 1);
-        n->descr_ = &(*buf)[0];
-    }
-    return n;
+    cout.flush();
+    FdSink out(STDOUT_FILENO);
+    printBFS(out);
 }
 
 void
-BuildTree::freeN(node_t *n)
+BuildTree::printDFS() const
 {
-    if (!n)
-        return;
-
-    if (n->left_)
-        delete n->left_;
-    if (n->right_)
-        delete n->right_;
-    if (n->descr_)
-        delete n->descr_;
-
-    n->left_ = n->right_ = NULL;
-    n->descr_ = NULL;
-    delete n;
-    return;
-}
-/**
- * Main method that interfaces external world. Use this to start
- * decoding.
- */
-int BuildTree::decodeFile()
-{
-    if (fileCheck(fname_) < 0)
-        return -1;
-
-    // open the fstream and start the big loop!.
-    inFile_.open(fname_.c_str(), fstream::in);
-    if (!inFile_) {
-        // TODO: Print error.
-        cerr << fname_ << " : error in open " << endl;
-        return -1;
-    }
-
-    int line_count = 0;
-    shared_ptr<string> line(new string); // not sure what getline does!.
-    while(!inFile_.eof()) {
-        line->clear();
-        getline(inFile_, *line);
-        if (line->length() == 0)
-            continue;
-
-        line_count++;
-
-        // we have a line parse it get a node.
-        node_t *n = parseLine(line);
-        if (!n) {
-            cerr << line_count << " : Error line - " << *line << endl;
-            freeN(n);
-            continue;
-        }
-
-        if (processNode(n, NULL, NULL) < 0) {
-            cerr << line_count << " : Error line - " << *line << endl;
-            inFile_.close();
-            freeN(n);
-            return(-1);
-        }
-    }
-
-    if (wait_count_ > 0) {
-        cerr << "Error - unresolved node count : " << wait_count_ << endl;
-        inFile_.close();
-        return(-1);
-    }
-
-    // After all the effort if the root is empty then no go.
-    if (decodedTree_ == NULL) {
-        cerr << "Error - could not build any tree!" << endl;
-        inFile_.close();
-        return(-1);
-    }
-
-    inFile_.close();
-    return 0;
+    cout.flush();
+    FdSink out(STDOUT_FILENO);
+    printDFS(out);
 }
 
 void
-BuildTree::printBFS() const
+BuildTree::printBFS(OutputSink& sink) const
 {
-    if (!decodedTree_)
+    if (snap_.isOpen()) {
+        snap_.printBFS(sink);
         return;
+    }
 
-    queue<node_t *> q;
-    q.push(decodedTree_);
-
-    while (q.size() != 0) {
-        node_t *t = q.front();
-        q.pop();
-        if (t->left_)
-            q.push(t->left_);
-        if (t->right_)
-            q.push(t->right_);
-        cout << t->descr_ << " ";
+    if (compact_.isBuilt()) {
+        SharedPhaseTimer t(traverseTimer());
+        compact_.printBFS(sink);
+        return;
     }
 
-    cout << endl;
-    return;
+    textTree_t::printBFS(sink);
 }
 
 void
-BuildTree::printDFSRecur(node_t *root) const
+BuildTree::printDFS(OutputSink& sink) const
 {
-    if (!root)
+    if (snap_.isOpen()) {
+        snap_.printDFS(sink);
         return;
+    }
 
-    printDFSRecur(root->left_);
-    cout << root->descr_ << " ";
-    printDFSRecur(root->right_);
-    return;
-}
+    if (compact_.isBuilt()) {
+        SharedPhaseTimer t(traverseTimer());
+        compact_.printDFS(sink);
+        return;
+    }
 
-void
-BuildTree::printDFS() const
-{
-    printDFSRecur(decodedTree_);
-    cout << endl;
-    return;
+    textTree_t::printDFS(sink);
 }
-
-
@@ -1,77 +1,115 @@
 // -*- C++ -*-
 
-#include <fstream>
-#include <stack>
 #include <cstdint>
-#include <unordered_map>
-#include <list>
 #include <memory>
+#include <ostream>
+#include <vector>
+#include <utility>
+#include "basic_build_tree.h"
+#include "snapshot.h"
+#include "tree_query.h"
+#include "compact_tree.h"
 using namespace std;
 
-struct node
+#ifndef BUILD_TREE_H
+#define BUILD_TREE_H
+
+struct node : text_payload
 {
     int id_;
     struct node *left_;
     struct node *right_;
-    char* descr_;
 };
 
 typedef struct node node_t;
 
-enum class Status : std::int8_t
+/// BuildTree nodes stay struct node, snapshot.h and friends use it.
+template <>
+struct node_type<int, text_payload>
 {
-    NONE = 0,         /// invalid
-    NODE_WAIT = 1,    /// node is waiting.
-    NONNODE_WAIT = 2, /// non node is waiting.
-    FILLED = 3        /// Found a line with this node_id
+    typedef node_t type;
 };
 
-typedef struct hash_ref
-{
-    node_t** nodePtr_;
-    Status status_;
-} href_t;
+typedef basic_href<node_t> href_t;
+typedef FlatIndex<href_t> idIndex_t;
+typedef BasicBuildTree<int, text_payload> textTree_t;
 
-typedef list<hash_ref *> nodeList_t;
-typedef unordered_map<int, nodeList_t*> hashMap_t;
+struct parse_chunk;                /// see build_tree_parallel.cc
 
-class BuildTree
+/**
+ * The decoder decode_tree uses: int ids and text descriptions, see
+ * basic_build_tree.h for decode, feed() and the traversals. Adds the
+ * parallel decode, snapshots, queries, updates and compact copies,
+ * which all work on node_t.
+ */
+class BuildTree : public textTree_t
 {
 public:
     BuildTree();
-    BuildTree(string& fname, bool complete_tree=true, bool dup_ids=false);
+    BuildTree(const string& fname, bool complete_tree=true,
+              bool dup_ids=false);
     virtual ~BuildTree();
 
     int decodeFile();
-    void printBFS() const;
+    void printBFS() const;        /// to stdout
     void printDFS() const;
+    void printBFS(OutputSink& sink) const;
+    void printDFS(OutputSink& sink) const;
+
+    decode_stats_t stats() const;
+
+    /// Lookups by id, parent/depth/subtree, see tree_query.h. Call
+    /// prepareQuery() once after decodeFile(), query() is empty before.
+    /// lca also builds the lca()/lcaBatch() table.
+    int prepareQuery(const bool lca = false);
+    const TreeQuery& query() const { return query_; }
+
+    /// Incremental updates after a decode, unique ids only, see
+    /// build_tree_update.cc. All return 0, or -1 leaving the tree as it was.
+    int addRecord(const char *line, size_t len);
+    int removeRecord(const int id);
+    int replaceRecord(const char *line, size_t len);
+    /// 0 if a fresh decode of fname gives the same tree as ours.
+    int validate(const string& fname) const;
 
-    void setMaxFileSize(const unsigned int fsize); /// in Bytes.
+    /// Copy the tree into a CompactTree, traversals run on it from then
+    /// on, see compact_tree.h. Undone by any update.
+    int compact(const Layout layout);
+
+    int saveSnapshot(const string& fname) const; /// after decodeFile()
+    int loadSnapshot(const string& fname);       /// instead of decodeFile()
+
+    void setThreads(const unsigned int threads); /// > 1 parallel parse, print
+    void setShardedStitch(const bool sharded);   /// stitch in parallel too.
+
+    /// Drop the tree and point at fname for the next decodeFile(), the
+    /// options, arenas and id map capacity stay (see batch_decode.cc).
+    void reuse(const string& fname);
 
 private:
-    void printDFSRecur(node_t *root) const;
-    int markParentFilled(node_t *n);
-    int insertHashMap(node_t &n, node_t **holder, Status s);
-    int checkHashMap(node_t *n, node_t **holder, node_t *parent);
-
-    int processNode(node_t *n, node_t **holder,
-                    node_t *parent); /// Helper to process new Node
-    node_t *parseLine(shared_ptr<string> line);             /// Helper to process the line.
-    void freeN(node_t *n);
+    int decodeParallel();         /// see build_tree_parallel.cc
+    int decodeSharded();
+    void parseChunk(struct parse_chunk& chunk, SlabArena<node_t>& nodes,
+                    StringPool& descrs) const;
+    int stitchChunk(struct parse_chunk& chunk, uint64_t& line_count);
+    void addWorkerArenas(size_t workers);
+    int canUpdate() const;        /// see build_tree_update.cc
+    href_t *refFor(const int id);
+    void settleShifts();
+    node_t *parseRecord(const char *line, size_t len);
+    int checkChildren(const node_t *n, const href_t *own);
+    void detachChildren(node_t *n);
+    void treeChanged();
     void decomission();
-    int fileCheck(const string& fname);          /// is File and check limit.
-
-    node_t *decodedTree_;          /// The decoded tree.
-    /// Helps with late inserts and error checks.
-    /// the list helps us maintain order of parsing.
-    hashMap_t  insertMap_;
-    int wait_count_;              /// if does not become zero then we have
-                                  /// bad input
-    string fname_;                /// Input filename
-    fstream inFile_;              /// Input File Stream
-    unsigned int maxFSize_;       /// Overrides the default
-    bool complete_tree_;          /// support for partial!
-    bool duplicate_ids_;          /// duplicate node id support.
-};
 
+    unsigned int threads_;        /// parser threads for decodeParallel()
+    bool sharded_;                /// decodeSharded() instead.
+    /// one pair per parser thread, nodes parsed there live on in them.
+    vector<unique_ptr<SlabArena<node_t> > > workerNodes_;
+    vector<unique_ptr<StringPool> > workerDescrs_;
+    TreeSnapshot snap_;           /// printBFS/printDFS use this if loaded
+    TreeQuery query_;             /// filled by prepareQuery()
+    CompactTree compact_;         /// filled by compact()
+};
 
+#endif
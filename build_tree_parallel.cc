@@ -0,0 +1,464 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:build_tree_parallel.cc
+ * Multi threaded decode for BuildTree (-t <threads>).
+ * The mapped file is cut into newline aligned chunks which worker
+ * threads turn into node batches, parseSpan() only touches the worker's
+ * own arenas. Stitching (processNode/checkHashMap) stays on the calling
+ * thread and consumes the batches in file order, so the outcome and
+ * every diagnostic match the serial path line for line.
+ *
+ * With setShardedStitch() (-p) the stitch runs in parallel as well, see
+ * decodeSharded().
+ */
+
+#include "build_tree.h"
+#include <string.h>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+const size_t minChunkSize = 1024 * 1024;  /// in Bytes
+const size_t chunksPerThread = 8;         /// keeps the workers balanced
+
+typedef struct parsed_line
+{
+    node_t *n_;                   /// NULL if the line did not parse
+    const char *line_;            /// for diagnostics
+    unsigned int len_;
+    ParseError err_;
+} parsed_line_t;
+
+struct parse_chunk
+{
+    const char *begin_;
+    const char *end_;
+    vector<parsed_line_t> lines_;
+    bool done_;
+};
+typedef struct parse_chunk parse_chunk_t;
+
+/**
+ * What the sharded stitch knows about one id, counts are kept so we can
+ * tell a clean input (every id at most one line and one reference) from
+ * one that needs the serial rules.
+ */
+typedef struct link_ref
+{
+    node_t *record_;              /// the line carrying this id
+    node_t **holder_;             /// child slot that refers to this id
+    node_t *parent_;              /// owner of holder_
+    unsigned int records_;
+    unsigned int refs_;
+} link_ref_t;
+
+typedef FlatIndex<link_ref_t> linkIndex_t;
+typedef vector<pair<int, link_ref_t> > linkBox_t;
+
+/**
+ * Cut [begin, end) into pieces of roughly chunk_size that all end right
+ * after a newline (or at end).
+ */
+static void
+splitChunks(const char *begin, const char *end, size_t chunk_size,
+            vector<parse_chunk_t>& chunks)
+{
+    for (const char *p = begin; p < end; ) {
+        const char *stop = end;
+        if ((size_t)(end - p) > chunk_size) {
+            const char *nl = (const char *)memchr(p + chunk_size, '\n',
+                                                  end - (p + chunk_size));
+            stop = (nl ? nl + 1 : end);
+        }
+
+        parse_chunk_t c;
+        c.begin_ = p;
+        c.end_ = stop;
+        c.done_ = false;
+        chunks.push_back(c);
+        p = stop;
+    }
+}
+
+/**
+ * Worker side, parse every non empty line of the chunk into nodes.
+ */
+void
+BuildTree::parseChunk(parse_chunk_t& chunk, SlabArena<node_t>& nodes,
+                      StringPool& descrs) const
+{
+    const char *end = chunk.end_;
+    for (const char *p = chunk.begin_; p < end; ) {
+        const char *line = p;
+        const char *nl = findNewline(p, end);
+        size_t len = nl - line;
+        p = (nl < end ? nl + 1 : end);
+        if (len == 0)
+            continue;
+
+        parsed_line_t pl;
+        pl.line_ = line;
+        pl.len_ = len;
+        pl.n_ = parseSpan(line, len, nodes, descrs, &pl.err_);
+        chunk.lines_.push_back(pl);
+    }
+}
+
+/**
+ * Serial stitch of one parsed chunk, same diagnostics as decodeMapped().
+ */
+int
+BuildTree::stitchChunk(parse_chunk_t& chunk, uint64_t& line_count)
+{
+    vector<parsed_line_t>& lines = chunk.lines_;
+    PhaseTimer t(timer(stats_.stitchMs_));
+    for (size_t i = 0; i < lines.size(); ++i) {
+        line_count++;
+        stats_.lines_++;
+
+        parsed_line_t& pl = lines[i];
+        if (!pl.n_) {
+            badLine(pl.err_, pl.line_, pl.len_, line_count);
+            continue;
+        }
+
+        if (stitchRecord(pl.n_, pl.line_, pl.len_, line_count) < 0)
+            return(-1);
+    }
+    return(0);
+}
+
+/**
+ * One arena pair per worker, kept by us since the tree points into them.
+ */
+void
+BuildTree::addWorkerArenas(size_t workers)
+{
+    for (size_t w = 0; w < workers; ++w) {
+        workerNodes_.push_back(unique_ptr<SlabArena<node_t> >(
+                                   new SlabArena<node_t>));
+        workerDescrs_.push_back(unique_ptr<StringPool>(new StringPool));
+    }
+}
+
+int
+BuildTree::decodeParallel()
+{
+    if (mapMappedFile() < 0)
+        return -1;
+
+    size_t chunk_size = max(minChunkSize,
+                            mapped_.size() / (threads_ * chunksPerThread));
+    vector<parse_chunk_t> chunks;
+    splitChunks(mapped_.begin(), mapped_.end(), chunk_size, chunks);
+
+    size_t workers = min((size_t)threads_, chunks.size());
+    size_t first_worker = workerNodes_.size();
+    addWorkerArenas(workers);
+
+    mutex mtx;
+    condition_variable cv;
+    atomic<size_t> next(0);
+    atomic<bool> abort(false);
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        SlabArena<node_t> *nodes = workerNodes_[first_worker + w].get();
+        StringPool *descrs = workerDescrs_[first_worker + w].get();
+        pool.push_back(thread([&, nodes, descrs]() {
+            for (;;) {
+                size_t c = next++;
+                if (c >= chunks.size() || abort)
+                    break;
+
+                parseChunk(chunks[c], *nodes, *descrs);
+                {
+                    lock_guard<mutex> lock(mtx);
+                    chunks[c].done_ = true;
+                }
+                cv.notify_all();
+            }
+        }));
+    }
+
+    // stitch in file order while the workers run ahead.
+    int ret = 0;
+    uint64_t line_count = 0;
+    for (size_t c = 0; c < chunks.size() && ret == 0; ++c) {
+        {
+            // time the stitcher sits idle waiting for the parsers.
+            PhaseTimer t(timer(stats_.parseMs_));
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [&]() { return chunks[c].done_; });
+        }
+
+        ret = stitchChunk(chunks[c], line_count);
+        vector<parsed_line_t>().swap(chunks[c].lines_);
+    }
+
+    abort = true;
+    for (size_t w = 0; w < pool.size(); ++w) {
+        pool[w].join();
+    }
+
+    return ret;
+}
+
+static void
+noteLink(linkIndex_t& idx, int id, node_t *record, node_t **holder,
+         node_t *parent)
+{
+    linkIndex_t::slot *s = idx.insert(id);
+    if (s->size() == 0) {
+        link_ref_t lr;
+        memset(&lr, 0, sizeof(lr));
+        s->push_back(lr);
+    }
+
+    link_ref_t& lr = s->at(0);
+    if (record) {
+        if (!lr.record_)
+            lr.record_ = record;
+        lr.records_++;
+    } else {
+        if (!lr.holder_) {
+            lr.holder_ = holder;
+            lr.parent_ = parent;
+        }
+        lr.refs_++;
+    }
+}
+
+/**
+ * Parallel parse and parallel stitch.
+ * 1. Every worker parses a contiguous run of chunks and pairs up the
+ *    lines and child references it saw locally in its own index.
+ * 2. Ids are partitioned into shards, each worker hands its local
+ *    entries to the owning shard, shard owners merge them (in worker
+ *    order, i.e. file order) and keep their own wait counts.
+ * 3. If every id has at most one line and one reference the serial
+ *    stitch has exactly one outcome: root is the first line, or the line
+ *    referring to it when that one is not referenced itself, and
+ *    wait_count_ is the unfilled references plus the other unreferenced
+ *    lines. Only then do the shards link the children in parallel.
+ * Anything else (-d, conflicts, unresolved ids) is replayed through
+ * processNode() in file order so diagnostics and results stay exactly
+ * those of the serial path. So is any input under setMaxWaiting(): the
+ * limit is on wait_count_ while lines come in, the shards only see the
+ * end of it.
+ */
+int
+BuildTree::decodeSharded()
+{
+    if (mapMappedFile() < 0)
+        return -1;
+
+    size_t chunk_size = max(minChunkSize,
+                            mapped_.size() / (threads_ * chunksPerThread));
+    vector<parse_chunk_t> chunks;
+    splitChunks(mapped_.begin(), mapped_.end(), chunk_size, chunks);
+
+    size_t workers = max((size_t)1, min((size_t)threads_, chunks.size()));
+    size_t shards = workers * 4;
+    size_t first_worker = workerNodes_.size();
+    addWorkerArenas(workers);
+    bool pairs = !duplicate_ids_ && maxWait_ <= 0;  // phases 1-3 apply
+
+    // phase 1: parse + local pairing, worker w owns chunks [lo, hi).
+    vector<vector<linkBox_t> > outbox(workers, vector<linkBox_t>(shards));
+    vector<thread> pool;
+    PhaseTimer parse_timer(timer(stats_.parseMs_));
+    for (size_t w = 0; w < workers; ++w) {
+        pool.push_back(thread([&, w]() {
+            size_t lo = chunks.size() * w / workers;
+            size_t hi = chunks.size() * (w + 1) / workers;
+            linkIndex_t local;
+            for (size_t c = lo; c < hi; ++c) {
+                parseChunk(chunks[c], *workerNodes_[first_worker + w],
+                           *workerDescrs_[first_worker + w]);
+                if (!pairs)
+                    continue;
+
+                vector<parsed_line_t>& lines = chunks[c].lines_;
+                for (size_t i = 0; i < lines.size(); ++i) {
+                    node_t *n = lines[i].n_;
+                    if (!n)
+                        continue;
+                    noteLink(local, n->id_, n, NULL, NULL);
+                    if (n->left_)
+                        noteLink(local, n->left_->id_, NULL, &n->left_, n);
+                    if (n->right_)
+                        noteLink(local, n->right_->id_, NULL, &n->right_, n);
+                }
+            }
+
+            local.forEach([&](linkIndex_t::slot& s) {
+                size_t shard = (unsigned int)s.key_ % shards;
+                outbox[w][shard].push_back(make_pair(s.key_, s.at(0)));
+            });
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+    pool.clear();
+    parse_timer.stop();
+    PhaseTimer stitch_timer(timer(stats_.stitchMs_));
+
+    node_t *first = NULL;         // first line, the serial root candidate.
+    for (size_t c = 0; c < chunks.size() && !first; ++c) {
+        for (size_t i = 0; i < chunks[c].lines_.size() && !first; ++i)
+            first = chunks[c].lines_[i].n_;
+    }
+
+    // phase 2: merge per shard, count what would still be waiting.
+    vector<linkIndex_t *> shard_idx(shards);
+    vector<int> shard_wait(shards, 0);
+    vector<vector<node_t *> > shard_unref(shards);
+    vector<char> shard_clean(shards, 1);
+    link_ref_t first_link;
+    memset(&first_link, 0, sizeof(first_link));
+    if (first && pairs) {
+        for (size_t w = 0; w < workers; ++w) {
+            pool.push_back(thread([&, w]() {
+                for (size_t s = w; s < shards; s += workers) {
+                    linkIndex_t *idx = new linkIndex_t;
+                    shard_idx[s] = idx;
+                    for (size_t src = 0; src < workers; ++src) {
+                        linkBox_t& box = outbox[src][s];
+                        for (size_t i = 0; i < box.size(); ++i) {
+                            linkIndex_t::slot *e = idx->insert(box[i].first);
+                            if (e->size() == 0) {
+                                e->push_back(box[i].second);
+                                continue;
+                            }
+                            link_ref_t& lr = e->at(0);
+                            if (!lr.record_)
+                                lr.record_ = box[i].second.record_;
+                            if (!lr.holder_) {
+                                lr.holder_ = box[i].second.holder_;
+                                lr.parent_ = box[i].second.parent_;
+                            }
+                            lr.records_ += box[i].second.records_;
+                            lr.refs_ += box[i].second.refs_;
+                        }
+                        linkBox_t().swap(box);
+                    }
+
+                    idx->forEach([&](linkIndex_t::slot& e) {
+                        link_ref_t& lr = e.at(0);
+                        if (lr.records_ > 1 || lr.refs_ > 1) {
+                            shard_clean[s] = 0;
+                        } else if (lr.records_ == 0) {
+                            shard_wait[s]++;      // reference never filled
+                        } else if (lr.refs_ == 0) {
+                            shard_unref[s].push_back(lr.record_);
+                        }
+                    });
+                }
+            }));
+        }
+        for (size_t w = 0; w < pool.size(); ++w)
+            pool[w].join();
+        pool.clear();
+
+        linkIndex_t::slot *fs =
+            shard_idx[(unsigned int)first->id_ % shards]->find(first->id_);
+        first_link = fs->at(0);
+    }
+
+    // merge: decide if the serial rules leave any room for doubt.
+    bool clean = (first != NULL && pairs);
+    int wait = 0;
+    size_t unref = 0;
+    node_t *root = first;
+    for (size_t s = 0; s < shards && clean; ++s) {
+        clean = (shard_clean[s] != 0);
+        wait += shard_wait[s];
+        unref += shard_unref[s].size();
+    }
+
+    if (clean && first_link.refs_ == 1) {
+        // root shift, the line referring to the first line takes over.
+        root = first_link.parent_;
+        linkIndex_t::slot *ps =
+            shard_idx[(unsigned int)root->id_ % shards]->find(root->id_);
+        if (ps->at(0).refs_ != 0)
+            clean = false;
+    }
+    wait += (unref > 0 ? unref - 1 : 0);
+    clean = clean && wait == 0 && unref == 1;
+
+    if (clean) {
+        // phase 3: link, every holder belongs to exactly one id.
+        for (size_t w = 0; w < workers; ++w) {
+            pool.push_back(thread([&, w]() {
+                for (size_t s = w; s < shards; s += workers) {
+                    shard_idx[s]->forEach([](linkIndex_t::slot& e) {
+                        link_ref_t& lr = e.at(0);
+                        if (lr.holder_)
+                            *lr.holder_ = lr.record_;
+                    });
+                }
+            }));
+        }
+        for (size_t w = 0; w < pool.size(); ++w)
+            pool[w].join();
+        pool.clear();
+    }
+
+    for (size_t s = 0; s < shards; ++s)
+        delete shard_idx[s];
+    stitch_timer.stop();          // a serial replay times itself.
+
+    int ret = 0;
+    uint64_t line_count = 0;
+    if (!clean) {
+        for (size_t c = 0; c < chunks.size() && ret == 0; ++c)
+            ret = stitchChunk(chunks[c], line_count);
+        return ret;
+    }
+
+    // only lines that did not parse are left to report.
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        vector<parsed_line_t>& lines = chunks[c].lines_;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            line_count++;
+            stats_.lines_++;
+            if (lines[i].n_)
+                continue;
+            badLine(lines[i].err_, lines[i].line_, lines[i].len_,
+                    line_count);
+        }
+    }
+
+    decodedTree_ = root;
+    wait_count_ = 0;
+    return ret;
+}
@@ -0,0 +1,387 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:build_tree_update.cc
+ * Incremental updates: add, remove or replace single records of a
+ * decoded tree instead of decoding the whole file again.
+ *   bt.decodeFile();
+ *   bt.replaceRecord(line, len);   // "25 26 27 new description"
+ *   bt.removeRecord(3);            // its parent waits for a new "3 ..."
+ *   bt.validate(newFname);         // optional, against a fresh decode
+ * Only the entries of the ids on the changed line move between the
+ * insertMap_ states, and wait_count_ follows just like during decode:
+ * removing a record turns its reference back into a NONNODE_WAIT
+ * placeholder and leaves its children as NODE_WAIT subtrees waiting for
+ * a parent. The tree is complete again once waitCount() is 0.
+ *
+ * Needs one entry per id, so not with -d, not after large input mode
+ * retired entries and not after a sharded decode (no insertMap_).
+ * Every change is checked before anything is touched, a refused update
+ * leaves the tree as it was. The query index and the compact copy are
+ * dropped on change, call prepareQuery()/compact() again.
+ */
+
+#include "build_tree.h"
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * -1 with a message if updates cannot work on what decodeFile() left.
+ */
+int
+BuildTree::canUpdate() const
+{
+    if (duplicate_ids_ || large_) {
+        *err_ << "updates need unique ids and no large input mode" << endl;
+        return(-1);
+    }
+
+    if (decodedTree_ == NULL || insertMap_.empty()) {
+        *err_ << "updates need a tree decoded without -p" << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+href_t *
+BuildTree::refFor(const int id)
+{
+    idIndex_t::slot *s = insertMap_.find(id);
+    return (s ? &s->at(0) : NULL);
+}
+
+/**
+ * During decode a root shift leaves the old root's entry pointing at
+ * decodedTree_ and the new root's entry pointing at the node itself
+ * (see markParentFilled()). Before updates every FILLED entry has to
+ * point at the holder of its node, replay the shifts to get there.
+ */
+void
+BuildTree::settleShifts()
+{
+    for (size_t i = 0; i < shiftLog_.size(); ++i) {
+        node_t *root = shiftLog_[i].first;
+        node_t **holder = shiftLog_[i].second;
+
+        href_t *old_root = refFor((*holder)->id_);
+        if (old_root)
+            old_root->nodePtr_ = holder;
+        href_t *new_root = refFor(root->id_);
+        if (new_root)
+            new_root->nodePtr_ = &decodedTree_;
+    }
+    shiftLog_.clear();
+}
+
+/**
+ * parseSpan() into nodes_, the description is copied since line is the
+ * caller's.
+ */
+node_t *
+BuildTree::parseRecord(const char *line, size_t len)
+{
+    ParseError err;
+    node_t *n = parseSpan(line, len, nodes_, descrs_, &err);
+    if (!n) {
+        printParseError(err);
+        *err_ << "update : Error line - ";
+        err_->write(line, len) << endl;
+        return NULL;
+    }
+
+    if (n->descr_ >= line && n->descr_ < line + len)
+        n->descr_ = descrs_.copy(n->descr_, n->dlen_);
+    return n;
+}
+
+/**
+ * Children of n may be new ids or records waiting for a parent. Taking
+ * the root as a child is only possible for a record nobody references
+ * yet (own is NULL), anything else would make a cycle.
+ */
+int
+BuildTree::checkChildren(const node_t *n, const href_t *own)
+{
+    if (n->left_ && n->right_ && n->left_->id_ == n->right_->id_) {
+        *err_ << "update : both children are " << n->left_->id_ << endl;
+        return(-1);
+    }
+
+    const node_t *kids[2] = { n->left_, n->right_ };
+    for (int k = 0; k < 2; ++k) {
+        if (!kids[k])
+            continue;
+
+        const href_t *ln = refFor(kids[k]->id_);
+        if (!ln || ln->status_ == Status::NODE_WAIT)
+            continue;
+        if (ln->status_ == Status::FILLED && ln->nodePtr_ == &decodedTree_ &&
+            own == NULL && kids[k]->id_ != n->id_)
+            continue;
+
+        *err_ << "update : child " << kids[k]->id_
+              << " already has a parent" << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ * Undo what linking n's children did: a placeholder child drops its
+ * NONNODE_WAIT entry, a real child goes back to NODE_WAIT.
+ */
+void
+BuildTree::detachChildren(node_t *n)
+{
+    node_t **slots[2] = { &n->left_, &n->right_ };
+    for (int k = 0; k < 2; ++k) {
+        node_t *c = *slots[k];
+        if (!c)
+            continue;
+
+        idIndex_t::slot *s = insertMap_.find(c->id_);
+        href_t *ln = &s->at(0);
+        if (ln->status_ == Status::NONNODE_WAIT) {
+            insertMap_.erase(s);
+            wait_count_--;
+        } else {
+            ln->status_ = Status::NODE_WAIT;
+            ln->nodePtr_ = (node_t **)c;  /// same hack as insertHashMap()
+            wait_count_++;
+        }
+        *slots[k] = NULL;
+    }
+}
+
+/**
+ * Anything derived from the pointer tree is stale now.
+ */
+void
+BuildTree::treeChanged()
+{
+    query_.clear();
+    compact_.clear();
+}
+
+/**
+ * A new line, same as one more line at the end of the file.
+ */
+int
+BuildTree::addRecord(const char *line, size_t len)
+{
+    if (canUpdate() < 0)
+        return(-1);
+    settleShifts();
+
+    node_t *n = parseRecord(line, len);
+    if (!n)
+        return(-1);
+
+    const href_t *own = refFor(n->id_);
+    if (own && own->status_ != Status::NONNODE_WAIT) {
+        *err_ << "update : " << n->id_ << " already has a record" << endl;
+        return(-1);
+    }
+    if (checkChildren(n, own) < 0)
+        return(-1);
+
+    treeChanged();
+    int ret = processNode(n, NULL, NULL);
+    settleShifts();
+    return (ret < 0 ? -1 : 0);
+}
+
+/**
+ * Drop the record of id. Whoever referenced it waits for a new one, its
+ * children wait for a new parent. The root cannot go, a fresh decode
+ * would pick another root which updates cannot know.
+ */
+int
+BuildTree::removeRecord(const int id)
+{
+    if (canUpdate() < 0)
+        return(-1);
+    settleShifts();
+
+    idIndex_t::slot *s = insertMap_.find(id);
+    href_t *ln = (s ? &s->at(0) : NULL);
+    if (!ln || ln->status_ == Status::NONNODE_WAIT) {
+        *err_ << "update : no record for " << id << endl;
+        return(-1);
+    }
+    if (ln->nodePtr_ == &decodedTree_) {
+        *err_ << "update : " << id << " is the root" << endl;
+        return(-1);
+    }
+
+    treeChanged();
+    node_t *n = (ln->status_ == Status::NODE_WAIT ? (node_t *)ln->nodePtr_
+                                                  : *ln->nodePtr_);
+    detachChildren(n);
+
+    // re-look up, detachChildren() may have moved the slot.
+    ln = refFor(id);
+    if (ln->status_ == Status::NODE_WAIT) {
+        insertMap_.erase(insertMap_.find(id));
+        wait_count_--;
+        return(0);
+    }
+
+    node_t *placeholder = nodes_.alloc();
+    placeholder->id_ = id;
+    *ln->nodePtr_ = placeholder;
+    ln->status_ = Status::NONNODE_WAIT;
+    wait_count_++;
+    return(0);
+}
+
+/**
+ * New description and/or children for an existing record, the node
+ * stays where it is. Same children means only the description changes.
+ */
+int
+BuildTree::replaceRecord(const char *line, size_t len)
+{
+    if (canUpdate() < 0)
+        return(-1);
+    settleShifts();
+
+    node_t *n = parseRecord(line, len);
+    if (!n)
+        return(-1);
+
+    href_t *ln = refFor(n->id_);
+    if (!ln || ln->status_ == Status::NONNODE_WAIT) {
+        *err_ << "update : no record for " << n->id_ << endl;
+        return(-1);
+    }
+
+    node_t *cur = (ln->status_ == Status::NODE_WAIT ? (node_t *)ln->nodePtr_
+                                                    : *ln->nodePtr_);
+    bool same_left = ((!cur->left_ && !n->left_) ||
+                      (cur->left_ && n->left_ &&
+                       cur->left_->id_ == n->left_->id_));
+    bool same_right = ((!cur->right_ && !n->right_) ||
+                       (cur->right_ && n->right_ &&
+                        cur->right_->id_ == n->right_->id_));
+    if (same_left && same_right) {
+        treeChanged();
+        cur->descr_ = n->descr_;
+        cur->dlen_ = n->dlen_;
+        return(0);
+    }
+
+    // children change, they must be free to take before we let go of
+    // the old ones. An old child may come back, so check against the
+    // index as it will be once the old ones are detached.
+    node_t *old_left = cur->left_, *old_right = cur->right_;
+    const bool was_wait = (ln->status_ == Status::NODE_WAIT);
+    node_t *kids[2] = { n->left_, n->right_ };
+    for (int k = 0; k < 2; ++k) {
+        if (!kids[k])
+            continue;
+        if ((old_left && old_left->id_ == kids[k]->id_) ||
+            (old_right && old_right->id_ == kids[k]->id_))
+            kids[k] = NULL;
+    }
+    node_t probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.id_ = n->id_;
+    probe.left_ = kids[0];
+    probe.right_ = kids[1];
+    if (n->left_ && n->right_ && n->left_->id_ == n->right_->id_) {
+        *err_ << "update : both children are " << n->left_->id_ << endl;
+        return(-1);
+    }
+    if (checkChildren(&probe, was_wait ? NULL : ln) < 0)
+        return(-1);
+
+    treeChanged();
+    cur->descr_ = n->descr_;
+    cur->dlen_ = n->dlen_;
+    detachChildren(cur);
+    cur->left_ = n->left_;
+    cur->right_ = n->right_;
+
+    int ret = 0;
+    if (cur->left_)
+        ret = processNode(cur->left_, &cur->left_, cur);
+    if (ret >= 0 && cur->right_)
+        ret = processNode(cur->right_, &cur->right_, cur);
+    settleShifts();
+    return (ret < 0 ? -1 : 0);
+}
+
+/**
+ * Walk both trees in preorder side by side.
+ */
+static bool
+sameTree(const node_t *a, const node_t *b, int *where)
+{
+    vector<pair<const node_t *, const node_t *> > stack;
+    stack.push_back(make_pair(a, b));
+    while (!stack.empty()) {
+        const node_t *x = stack.back().first;
+        const node_t *y = stack.back().second;
+        stack.pop_back();
+        if (!x && !y)
+            continue;
+        if (!x || !y || x->id_ != y->id_ || x->dlen_ != y->dlen_ ||
+            memcmp(x->descr_, y->descr_, x->dlen_) != 0) {
+            *where = (x ? x->id_ : y->id_);
+            return false;
+        }
+        stack.push_back(make_pair(x->right_, y->right_));
+        stack.push_back(make_pair(x->left_, y->left_));
+    }
+    return true;
+}
+
+int
+BuildTree::validate(const string& fname) const
+{
+    if (checkDecoded() < 0)
+        return(-1);
+
+    string name(fname);
+    BuildTree fresh(name, complete_tree_, duplicate_ids_);
+    fresh.setInputMode(mode_);
+    fresh.setMaxFileSize(maxFSize_);
+    fresh.setMaxLineSize(maxLineSize_);
+    fresh.setErrorStream(*err_);
+    if (fresh.decodeFile() < 0) {
+        *err_ << "validate : " << fname << " does not decode" << endl;
+        return(-1);
+    }
+
+    int where = 0;
+    if (!sameTree(decodedTree_, fresh.decodedTree_, &where)) {
+        *err_ << "validate : trees differ at node id " << where << endl;
+        return(-1);
+    }
+    return(0);
+}
@@ -0,0 +1,284 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:compact_tree.cc
+ * Relayout of a decoded tree into a CompactTree, see compact_tree.h.
+ * The pointer tree is numbered in preorder first, the layouts are then
+ * worked out on those numbers (no hashing of pointers) as the list of
+ * preorder numbers in storage order.
+ */
+
+#include "build_tree.h"
+#include "compact_tree.h"
+#include <iostream>
+#include <cassert>
+
+using namespace std;
+
+/// The pointer tree as preorder numbers, the root is 0.
+typedef struct pre_tree
+{
+    vector<const node_t *> nodes_;
+    vector<uint32_t> left_;
+    vector<uint32_t> right_;
+} pre_tree_t;
+
+static int
+numberPreorder(const node_t *root, pre_tree_t& pt)
+{
+    typedef struct pending
+    {
+        const node_t *n_;
+        uint32_t parent_;
+        bool left_;
+    } pending_t;
+
+    vector<pending_t> stack;
+    pending_t top = { root, compactNone, false };
+    stack.push_back(top);
+    while (!stack.empty()) {
+        pending_t p = stack.back();
+        stack.pop_back();
+
+        uint32_t i = pt.nodes_.size();
+        if (i == compactNone) {
+            cerr << "compact : too many nodes" << endl;
+            return(-1);
+        }
+        pt.nodes_.push_back(p.n_);
+        pt.left_.push_back(compactNone);
+        pt.right_.push_back(compactNone);
+        if (p.parent_ != compactNone)
+            (p.left_ ? pt.left_ : pt.right_)[p.parent_] = i;
+
+        if (p.n_->right_) {
+            pending_t r = { p.n_->right_, i, false };
+            stack.push_back(r);
+        }
+        if (p.n_->left_) {
+            pending_t l = { p.n_->left_, i, true };
+            stack.push_back(l);
+        }
+    }
+    return(0);
+}
+
+static void
+bfsOrder(const pre_tree_t& pt, vector<uint32_t>& order)
+{
+    order.push_back(0);
+    for (size_t head = 0; head < order.size(); ++head) {
+        uint32_t i = order[head];
+        if (pt.left_[i] != compactNone)
+            order.push_back(pt.left_[i]);
+        if (pt.right_[i] != compactNone)
+            order.push_back(pt.right_[i]);
+    }
+}
+
+/**
+ * van Emde Boas order of the subtree at r cut off after d levels: the
+ * top d/2 levels first, then every subtree hanging below them, each laid
+ * out the same way. Recursion depth is log2 of the tree height.
+ */
+static void
+vebOrder(const pre_tree_t& pt, const vector<uint32_t>& height, uint32_t r,
+         uint32_t d, vector<uint32_t>& order)
+{
+    if (d == 1) {
+        order.push_back(r);
+        return;
+    }
+
+    uint32_t top = d / 2;
+    vebOrder(pt, height, r, top, order);
+
+    // roots of the bottom trees, exactly top levels below r, left first.
+    vector<pair<uint32_t, uint32_t> > stack;     // (node, level below r)
+    vector<uint32_t> bottoms;
+    stack.push_back(make_pair(r, 0));
+    while (!stack.empty()) {
+        uint32_t i = stack.back().first;
+        uint32_t lvl = stack.back().second;
+        stack.pop_back();
+        if (lvl == top) {
+            bottoms.push_back(i);
+            continue;
+        }
+        if (pt.right_[i] != compactNone)
+            stack.push_back(make_pair(pt.right_[i], lvl + 1));
+        if (pt.left_[i] != compactNone)
+            stack.push_back(make_pair(pt.left_[i], lvl + 1));
+    }
+
+    for (size_t b = 0; b < bottoms.size(); ++b) {
+        uint32_t h = height[bottoms[b]];
+        vebOrder(pt, height, bottoms[b], (h < d - top ? h : d - top), order);
+    }
+}
+
+CompactTree::CompactTree()
+    : root_(compactNone),
+      layout_(Layout::BFS)
+{
+}
+
+CompactTree::~CompactTree()
+{
+}
+
+void
+CompactTree::clear()
+{
+    nodes_.clear();
+    descrOff_.clear();
+    blob_.clear();
+    root_ = compactNone;
+}
+
+int
+CompactTree::build(const node_t *root, Layout layout)
+{
+    clear();
+    if (!root)
+        return(-1);
+
+    pre_tree_t pt;
+    if (numberPreorder(root, pt) < 0)
+        return(-1);
+
+    size_t n = pt.nodes_.size();
+    vector<uint32_t> order;
+    order.reserve(n);
+    switch (layout) {
+    case Layout::BFS:
+        bfsOrder(pt, order);
+        break;
+    case Layout::PREORDER:
+        for (size_t i = 0; i < n; ++i)
+            order.push_back(i);
+        break;
+    case Layout::VEB: {
+        // children come after their parent in preorder.
+        vector<uint32_t> height(n, 1);
+        for (size_t i = n; i-- > 0; ) {
+            uint32_t l = pt.left_[i], r = pt.right_[i];
+            uint32_t hl = (l != compactNone ? height[l] : 0);
+            uint32_t hr = (r != compactNone ? height[r] : 0);
+            height[i] = 1 + (hl > hr ? hl : hr);
+        }
+        vebOrder(pt, height, 0, height[0], order);
+        break;
+    }
+    }
+
+    assert(order.size() == n);
+    vector<uint32_t> pos(n);
+    uint64_t blob = 0;
+    for (size_t k = 0; k < n; ++k) {
+        pos[order[k]] = k;
+        blob += pt.nodes_[order[k]]->dlen_;
+    }
+
+    nodes_.resize(n);
+    descrOff_.resize(n + 1);
+    blob_.resize(blob + 1);       // never empty, descr() takes &blob_[0]
+    blob = 0;
+    for (size_t k = 0; k < n; ++k) {
+        uint32_t i = order[k];
+        nodes_[k].left_ = (pt.left_[i] != compactNone ? pos[pt.left_[i]]
+                                                      : compactNone);
+        nodes_[k].right_ = (pt.right_[i] != compactNone ? pos[pt.right_[i]]
+                                                        : compactNone);
+        nodes_[k].id_ = pt.nodes_[i]->id_;
+        descrOff_[k] = blob;
+        memcpy(&blob_[blob], pt.nodes_[i]->descr_, pt.nodes_[i]->dlen_);
+        blob += pt.nodes_[i]->dlen_;
+    }
+    descrOff_[n] = blob;
+    root_ = pos[0];
+    layout_ = layout;
+    return(0);
+}
+
+/**
+ * A straight scan for the BFS layout, a queue of indices otherwise.
+ */
+void
+CompactTree::printBFS(OutputSink& sink) const
+{
+    if (!isBuilt())
+        return;
+
+    BufferedWriter out(sink);
+    if (layout_ == Layout::BFS) {
+        for (uint32_t i = 0; i < nodes_.size(); ++i) {
+            out.append(descr(i), descrLen(i));
+            out.put(' ');
+        }
+        out.put('\n');
+        return;
+    }
+
+    vector<uint32_t> queue;
+    queue.reserve(nodes_.size());
+    queue.push_back(root_);
+    for (size_t head = 0; head < queue.size(); ++head) {
+        uint32_t i = queue[head];
+        out.append(descr(i), descrLen(i));
+        out.put(' ');
+        if (nodes_[i].left_ != compactNone)
+            queue.push_back(nodes_[i].left_);
+        if (nodes_[i].right_ != compactNone)
+            queue.push_back(nodes_[i].right_);
+    }
+    out.put('\n');
+}
+
+/**
+ * In-order with an explicit stack of indices.
+ */
+void
+CompactTree::printDFS(OutputSink& sink) const
+{
+    if (!isBuilt())
+        return;
+
+    BufferedWriter out(sink);
+    vector<uint32_t> stack;
+    uint32_t cur = root_;
+    while (cur != compactNone || !stack.empty()) {
+        while (cur != compactNone) {
+            stack.push_back(cur);
+            cur = nodes_[cur].left_;
+        }
+        cur = stack.back();
+        stack.pop_back();
+        out.append(descr(cur), descrLen(cur));
+        out.put(' ');
+        cur = nodes_[cur].right_;
+    }
+    out.put('\n');
+}
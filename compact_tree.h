@@ -0,0 +1,73 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "out_writer.h"
+using namespace std;
+
+#ifndef COMPACT_TREE_H
+#define COMPACT_TREE_H
+
+struct node;
+
+const uint32_t compactNone = 0xffffffff;   /// no child
+
+enum class Layout : std::int8_t
+{
+    BFS = 0,          /// level by level, printBFS() is one linear scan
+    PREORDER = 1,     /// subtrees are contiguous
+    VEB = 2           /// van Emde Boas, good at any cache line/page size
+};
+
+/**
+ * A decoded tree copied into one array in a chosen node order, 32 bit
+ * child indices instead of pointers and 12 bytes per node. Descriptions
+ * sit in a separate blob (same order) so walking the shape does not
+ * drag them through the cache.
+ * Built from a finished tree and never changed, rebuild after updates.
+ */
+class CompactTree
+{
+public:
+    CompactTree();
+    virtual ~CompactTree();
+
+    int build(const struct node *root, Layout layout);  /// 0 or -1
+    void clear();
+    bool isBuilt() const { return !nodes_.empty(); }
+    size_t size() const { return nodes_.size(); }
+    Layout layout() const { return layout_; }
+    uint32_t root() const { return root_; }
+
+    int32_t id(uint32_t i) const { return nodes_[i].id_; }
+    uint32_t left(uint32_t i) const { return nodes_[i].left_; }
+    uint32_t right(uint32_t i) const { return nodes_[i].right_; }
+    const char *descr(uint32_t i) const { return &blob_[0] + descrOff_[i]; }
+    size_t descrLen(uint32_t i) const
+    {
+        return descrOff_[i + 1] - descrOff_[i];
+    }
+
+    void printBFS(OutputSink& sink) const;
+    void printDFS(OutputSink& sink) const;
+
+private:
+    CompactTree(const CompactTree&);        /// no copies.
+    CompactTree& operator=(const CompactTree&);
+
+    typedef struct compact_node
+    {
+        uint32_t left_;
+        uint32_t right_;
+        int32_t id_;
+    } compact_node_t;
+
+    vector<compact_node_t> nodes_;
+    vector<uint64_t> descrOff_;   /// size() + 1 entries into blob_
+    vector<char> blob_;
+    uint32_t root_;
+    Layout layout_;
+};
+
+#endif
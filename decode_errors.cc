@@ -0,0 +1,148 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:decode_errors.cc
+ * Error log of a decode, see decode_errors.h.
+ */
+
+#include "decode_errors.h"
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+DecodeErrors::DecodeErrors(size_t keep)
+    : keep_(keep)
+{
+    clear();
+}
+
+DecodeErrors::~DecodeErrors()
+{
+}
+
+void
+DecodeErrors::add(uint64_t line, int64_t id, DecodeError kind,
+                  ParseError parse)
+{
+    total_++;
+    counts_[(int)kind]++;
+    if (errors_.size() >= keep_)
+        return;
+
+    decode_error_t e;
+    e.line_ = line;
+    e.id_ = id;
+    e.kind_ = kind;
+    e.parse_ = parse;
+    errors_.push_back(e);
+}
+
+void
+DecodeErrors::addUnresolved(int64_t id)
+{
+    unresolvedTotal_++;
+    if (unresolved_.size() < keep_)
+        unresolved_.push_back(id);
+}
+
+void
+DecodeErrors::clear()
+{
+    errors_.clear();
+    total_ = 0;
+    memset(counts_, 0, sizeof(counts_));
+    unresolved_.clear();
+    unresolvedTotal_ = 0;
+}
+
+/**
+ *   skipped 3 lines : parse 1, NODE_WAIT 2
+ *   17 : NODE_WAIT 42
+ *   unresolved ids 2 : 5 9
+ */
+void
+DecodeErrors::printSummary(ostream& os, size_t show) const
+{
+    if (total_ > 0) {
+        os << "skipped " << total_ << " lines :";
+        const char *sep = " ";
+        for (int k = (int)DecodeError::PARSE;
+             k <= (int)DecodeError::WAIT_LIMIT; ++k) {
+            if (counts_[k] == 0)
+                continue;
+            os << sep << errorName((DecodeError)k) << " " << counts_[k];
+            sep = ", ";
+        }
+        os << endl;
+
+        for (size_t i = 0; i < errors_.size() && i < show; ++i) {
+            const decode_error_t& e = errors_[i];
+            os << e.line_ << " : " << errorName(e.kind_) << " ";
+            if (e.kind_ == DecodeError::PARSE)
+                os << errorName(e.parse_);
+            else
+                os << e.id_;
+            os << endl;
+        }
+        if (total_ > errors_.size() || errors_.size() > show)
+            os << "..." << endl;
+    }
+
+    if (unresolvedTotal_ > 0) {
+        os << "unresolved ids " << unresolvedTotal_ << " :";
+        for (size_t i = 0; i < unresolved_.size() && i < show; ++i)
+            os << " " << unresolved_[i];
+        if (unresolvedTotal_ > unresolved_.size() ||
+            unresolved_.size() > show)
+            os << " ...";
+        os << endl;
+    }
+}
+
+const char *
+errorName(DecodeError kind)
+{
+    switch (kind) {
+    case DecodeError::PARSE: return "parse";
+    case DecodeError::NODE_WAIT: return "NODE_WAIT";
+    case DecodeError::NONNODE_WAIT: return "NONNODE_WAIT";
+    case DecodeError::ROOT: return "root";
+    case DecodeError::DUPLICATE: return "duplicate";
+    case DecodeError::WAIT_LIMIT: return "wait limit";
+    default: return "none";
+    }
+}
+
+const char *
+errorName(ParseError kind)
+{
+    switch (kind) {
+    case ParseError::TOO_LONG: return "too long";
+    case ParseError::NO_ID: return "no id";
+    case ParseError::BAD_PAYLOAD: return "bad payload";
+    default: return "none";
+    }
+}
@@ -0,0 +1,81 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+using namespace std;
+
+#ifndef DECODE_ERRORS_H
+#define DECODE_ERRORS_H
+
+enum class ParseError : std::int8_t
+{
+    NONE = 0,
+    TOO_LONG = 1,     /// line exceeds maxLineSize_
+    NO_ID = 2,        /// line does not start with a node id
+    BAD_PAYLOAD = 3   /// payload::parse() refused the rest of the line
+};
+
+/// Why a line did not make it into the tree.
+enum class DecodeError : std::int8_t
+{
+    NONE = 0,
+    PARSE = 1,        /// see parse_
+    NODE_WAIT = 2,    /// a record for an id whose record is waiting
+    NONNODE_WAIT = 3, /// a reference to an id already referenced
+    ROOT = 4,         /// conflicts with the root or its take over
+    DUPLICATE = 5,    /// every ref of the id is filled (no -d)
+    WAIT_LIMIT = 6    /// setMaxWaiting() reached, always fatal
+};
+
+/**
+ * One bad line, 24 bytes. id_ is the id the stitch failed on, which
+ * may be a child of the record, and 0 for PARSE.
+ */
+typedef struct decode_error
+{
+    uint64_t line_;
+    int64_t id_;
+    DecodeError kind_;
+    ParseError parse_;
+} decode_error_t;
+
+/**
+ * What went wrong over a whole decode, instead of (or next to) one
+ * diagnostic line per error. The first keep errors and unresolved ids
+ * are kept as they are, after that only counted.
+ */
+class DecodeErrors
+{
+public:
+    explicit DecodeErrors(size_t keep = 1 << 16);
+    virtual ~DecodeErrors();
+
+    void add(uint64_t line, int64_t id, DecodeError kind,
+             ParseError parse = ParseError::NONE);
+    void addUnresolved(int64_t id);
+    void clear();
+
+    uint64_t size() const { return total_; }           /// incl. not kept
+    uint64_t count(DecodeError kind) const { return counts_[(int)kind]; }
+    const vector<decode_error_t>& errors() const { return errors_; }
+    uint64_t unresolvedCount() const { return unresolvedTotal_; }
+    const vector<int64_t>& unresolved() const { return unresolved_; }
+
+    /// Counts per kind, the first show errors and unresolved ids.
+    void printSummary(ostream& os, size_t show) const;
+
+private:
+    size_t keep_;
+    vector<decode_error_t> errors_;
+    uint64_t total_;
+    uint64_t counts_[(int)DecodeError::WAIT_LIMIT + 1];
+    vector<int64_t> unresolved_;
+    uint64_t unresolvedTotal_;
+};
+
+const char *errorName(DecodeError kind);
+const char *errorName(ParseError kind);
+
+#endif
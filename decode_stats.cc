@@ -0,0 +1,59 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:decode_stats.cc
+ * JSON dump of decode_stats_t for decode_tree -s.
+ */
+
+#include "decode_stats.h"
+#include <sys/time.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+void
+printStatsJson(ostream& os, const decode_stats_t& st)
+{
+    struct rusage ru;
+    long max_rss = st.maxRssKb_;
+    if (max_rss == 0 && getrusage(RUSAGE_SELF, &ru) == 0)
+        max_rss = ru.ru_maxrss;   // kB on Linux
+
+    os << "{\"ioMs\":" << st.ioMs_
+       << ",\"parseMs\":" << st.parseMs_
+       << ",\"stitchMs\":" << st.stitchMs_
+       << ",\"traverseMs\":" << st.traverseMs_
+       << ",\"lines\":" << st.lines_
+       << ",\"nodes\":" << st.nodes_
+       << ",\"lookups\":" << st.lookups_
+       << ",\"collisions\":" << st.collisions_
+       << ",\"peakWait\":" << st.peakWait_
+       << ",\"nodeWait\":" << st.nodeWait_
+       << ",\"nonNodeWait\":" << st.nonNodeWait_
+       << ",\"filled\":" << st.filled_
+       << ",\"rootShifts\":" << st.rootShifts_
+       << ",\"maxRssKb\":" << max_rss
+       << "}" << endl;
+}
@@ -0,0 +1,102 @@
+// -*- C++ -*-
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <ostream>
+using namespace std;
+
+#ifndef DECODE_STATS_H
+#define DECODE_STATS_H
+
+/**
+ * What a decode spent its time on and how the id map behaved.
+ * Counters are always kept (an increment each), the wall clock timers
+ * only run once BuildTree::enableStats() is called.
+ */
+typedef struct decode_stats
+{
+    double ioMs_;                 /// open/stat/mmap/getline
+    double parseMs_;              /// parseSpan (or waiting on it)
+    double stitchMs_;             /// processNode -> checkHashMap
+    double traverseMs_;           /// printBFS/printDFS
+    uint64_t lines_;              /// non empty lines seen
+    uint64_t nodes_;              /// node_t handed out, incl. placeholders
+    uint64_t lookups_;            /// insertMap_ find/insert calls
+    uint64_t collisions_;         /// extra slots probed by those calls
+    int64_t peakWait_;            /// highest wait_count_
+    uint64_t nodeWait_;           /// entries created NODE_WAIT
+    uint64_t nonNodeWait_;        /// entries created NONNODE_WAIT
+    uint64_t filled_;             /// entries that went to FILLED
+    uint64_t rootShifts_;         /// Status::FILLED root take overs
+    long maxRssKb_;               /// filled in by printStatsJson()
+} decode_stats_t;
+
+/// One line of JSON, keys match the field names without the _.
+void printStatsJson(ostream& os, const decode_stats_t& st);
+
+/**
+ * Adds the lifetime of the object to *ms, does nothing if ms is NULL.
+ */
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(double *ms)
+        : ms_(ms)
+    {
+        if (ms_)
+            start_ = chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer()
+    {
+        stop();
+    }
+
+    /// Account the time so far, later stop()s and the destructor are no-ops.
+    void stop()
+    {
+        if (ms_) {
+            chrono::duration<double, milli> d =
+                chrono::steady_clock::now() - start_;
+            *ms_ += d.count();
+            ms_ = NULL;
+        }
+    }
+
+private:
+    double *ms_;
+    chrono::steady_clock::time_point start_;
+};
+
+/**
+ * PhaseTimer for const paths that may run on several threads at once
+ * (printers of a published tree), adds nanoseconds to *ns atomically.
+ */
+class SharedPhaseTimer
+{
+public:
+    explicit SharedPhaseTimer(atomic<uint64_t> *ns)
+        : ns_(ns)
+    {
+        if (ns_)
+            start_ = chrono::steady_clock::now();
+    }
+
+    ~SharedPhaseTimer()
+    {
+        if (ns_) {
+            chrono::nanoseconds d = chrono::steady_clock::now() - start_;
+            ns_->fetch_add(d.count());
+        }
+    }
+
+private:
+    SharedPhaseTimer(const SharedPhaseTimer&);  /// no copies.
+    SharedPhaseTimer& operator=(const SharedPhaseTimer&);
+
+    atomic<uint64_t> *ns_;
+    chrono::steady_clock::time_point start_;
+};
+
+#endif
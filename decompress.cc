@@ -0,0 +1,494 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:decompress.cc
+ * Compressed input for decodeFile(), see decompress.h. The worker reads
+ * the file with read(2) and keeps inflating into the block it holds
+ * until the block is full or the input ends, then hands it over under
+ * lock_ and waits for the next buffer of the ring to be given back.
+ */
+
+#include "decompress.h"
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+/// block::state_
+const int blockIdle = 0;          /// free for the worker
+const int blockBusy = 1;          /// being filled
+const int blockReady = 2;
+
+static const unsigned char gzipMagic[] = { 0x1f, 0x8b };
+static const unsigned char zstdMagic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+Codec
+codecOf(const unsigned char *magic, size_t len)
+{
+    if (len >= sizeof(gzipMagic) &&
+        memcmp(magic, gzipMagic, sizeof(gzipMagic)) == 0)
+        return Codec::GZIP;
+    if (len >= sizeof(zstdMagic) &&
+        memcmp(magic, zstdMagic, sizeof(zstdMagic)) == 0)
+        return Codec::ZSTD;
+    return Codec::NONE;
+}
+
+int
+sniffCodec(const string& fname, Codec *codec, ostream& err)
+{
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err << fname << " : error in open " << strerror(errno) << endl;
+        return(-1);
+    }
+
+    unsigned char magic[4];
+    ssize_t n;
+    do {
+        n = ::read(fd, magic, sizeof(magic));
+    } while (n < 0 && errno == EINTR);
+    ::close(fd);
+    if (n < 0) {
+        err << fname << " : read error " << strerror(errno) << endl;
+        return(-1);
+    }
+
+    *codec = codecOf(magic, n);
+    return(0);
+}
+
+const char *
+codecName(Codec codec)
+{
+    switch (codec) {
+    case Codec::GZIP: return "gzip";
+    case Codec::ZSTD: return "zstd";
+    default: return "none";
+    }
+}
+
+/**
+ * gzip through zlib's inflate(), gzip header only (16 + MAX_WBITS).
+ */
+class GzipInflater : public Inflater
+{
+public:
+    GzipInflater()
+        : ok_(false)
+    {
+        memset(&z_, 0, sizeof(z_));
+        ok_ = (inflateInit2(&z_, 16 + MAX_WBITS) == Z_OK);
+    }
+
+    virtual ~GzipInflater()
+    {
+        if (ok_)
+            inflateEnd(&z_);
+    }
+
+    virtual int run(const char **in, size_t *in_len, char **out,
+                    size_t *out_len)
+    {
+        if (!ok_)
+            return(-1);
+
+        // avail_in/out are 32 bit, large blocks go in pieces.
+        uInt in_max = (uInt)(*in_len < UINT32_MAX ? *in_len : UINT32_MAX);
+        uInt out_max = (uInt)(*out_len < UINT32_MAX ? *out_len : UINT32_MAX);
+        z_.next_in = (Bytef *)*in;
+        z_.avail_in = in_max;
+        z_.next_out = (Bytef *)*out;
+        z_.avail_out = out_max;
+        int ret = inflate(&z_, Z_NO_FLUSH);
+        *in += in_max - z_.avail_in;
+        *in_len -= in_max - z_.avail_in;
+        *out += out_max - z_.avail_out;
+        *out_len -= out_max - z_.avail_out;
+
+        if (ret == Z_STREAM_END)
+            return(1);
+        if (ret == Z_OK || ret == Z_BUF_ERROR)
+            return(0);
+        return(-1);
+    }
+
+    virtual int reset()
+    {
+        return (inflateReset(&z_) == Z_OK ? 0 : -1);
+    }
+
+    virtual const char *error() const
+    {
+        if (!ok_)
+            return "inflateInit2 failed";
+        return (z_.msg ? z_.msg : "corrupt gzip data");
+    }
+
+private:
+    z_stream z_;
+    bool ok_;
+};
+
+#ifdef HAVE_ZSTD
+/**
+ * zstd through ZSTD_decompressStream(), a new frame is picked up
+ * without reset().
+ */
+class ZstdInflater : public Inflater
+{
+public:
+    ZstdInflater()
+        : ds_(ZSTD_createDStream()),
+          error_("ZSTD_createDStream failed")
+    {
+        if (ds_)
+            ZSTD_initDStream(ds_);
+    }
+
+    virtual ~ZstdInflater()
+    {
+        if (ds_)
+            ZSTD_freeDStream(ds_);
+    }
+
+    virtual int run(const char **in, size_t *in_len, char **out,
+                    size_t *out_len)
+    {
+        if (!ds_)
+            return(-1);
+
+        ZSTD_inBuffer ib = { *in, *in_len, 0 };
+        ZSTD_outBuffer ob = { *out, *out_len, 0 };
+        size_t ret = ZSTD_decompressStream(ds_, &ob, &ib);
+        if (ZSTD_isError(ret)) {
+            error_ = ZSTD_getErrorName(ret);
+            return(-1);
+        }
+        *in += ib.pos;
+        *in_len -= ib.pos;
+        *out += ob.pos;
+        *out_len -= ob.pos;
+        return (ret == 0 ? 1 : 0);
+    }
+
+    virtual int reset()
+    {
+        return (ZSTD_isError(ZSTD_initDStream(ds_)) ? -1 : 0);
+    }
+
+    virtual const char *error() const
+    {
+        return error_;
+    }
+
+private:
+    ZSTD_DStream *ds_;
+    const char *error_;
+};
+#endif
+
+Inflater *
+newInflater(Codec codec)
+{
+    switch (codec) {
+    case Codec::GZIP:
+        return new GzipInflater;
+#ifdef HAVE_ZSTD
+    case Codec::ZSTD:
+        return new ZstdInflater;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+Decompressor::Decompressor(size_t block_size, unsigned int depth)
+    : blockSize_(block_size),
+      blocks_(depth > 0 ? depth : 1),
+      err_(&cerr),
+      fd_(-1),
+      ownsFd_(false),
+      codec_(Codec::NONE),
+      next_(0),
+      held_(false),
+      inBytes_(0),
+      outBytes_(0),
+      filled_(0),
+      ended_(false),
+      stop_(false)
+{
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        blocks_[i].data_ = NULL;
+        blocks_[i].got_ = 0;
+        blocks_[i].state_ = blockIdle;
+    }
+}
+
+Decompressor::~Decompressor()
+{
+    close();
+    for (size_t i = 0; i < blocks_.size(); ++i)
+        free(blocks_[i].data_);
+}
+
+/**
+ * Open fname, find its codec and start the worker.
+ */
+int
+Decompressor::open(const string& fname, ostream& err)
+{
+    close();
+    fname_ = fname;
+    err_ = &err;
+
+    Codec codec = Codec::NONE;
+    if (sniffCodec(fname, &codec, err) < 0)
+        return(-1);
+
+    fd_ = ::open(fname.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        err << fname << " : error in open " << strerror(errno) << endl;
+        return(-1);
+    }
+    ownsFd_ = true;
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return start(codec);
+}
+
+int
+Decompressor::open(int fd, const string& name, const char *head,
+                   size_t head_len, ostream& err)
+{
+    close();
+    fname_ = name;
+    err_ = &err;
+    fd_ = fd;
+    ownsFd_ = false;
+    head_.assign(head, head_len);
+    return start(codecOf((const unsigned char *)head, head_len));
+}
+
+/**
+ * Codec and buffers for fd_, then the worker.
+ */
+int
+Decompressor::start(Codec codec)
+{
+    codec_ = codec;
+    inflater_.reset(newInflater(codec_));
+    if (!inflater_) {
+        *err_ << fname_ << " : " << codecName(codec_)
+              << " input is not supported by this build" << endl;
+        close();
+        return(-1);
+    }
+
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        blocks_[i].state_ = blockIdle;
+        if (!blocks_[i].data_ &&
+            !(blocks_[i].data_ = (char *)malloc(blockSize_))) {
+            *err_ << fname_ << " : out of memory for decompression" << endl;
+            close();
+            return(-1);
+        }
+    }
+
+    inBytes_ = 0;
+    outBytes_ = 0;
+    filled_ = 0;
+    ended_ = false;
+    error_.clear();
+    stop_ = false;
+    worker_ = thread(&Decompressor::workerLoop, this);
+    return(0);
+}
+
+int
+Decompressor::next(const char **buf, size_t *len)
+{
+    unique_lock<mutex> g(lock_);
+    if (held_) {
+        // the caller is done with the block before, the worker may refill.
+        held_ = false;
+        blocks_[(next_ - 1) % blocks_.size()].state_ = blockIdle;
+        changed_.notify_all();
+    }
+
+    block& k = blocks_[next_ % blocks_.size()];
+    changed_.wait(g, [&]() {
+        return next_ < filled_ || ended_;
+    });
+    if (next_ >= filled_) {
+        if (!error_.empty()) {
+            *err_ << fname_ << " : " << error_ << endl;
+            return(-1);
+        }
+        return(0);
+    }
+
+    *buf = k.data_;
+    *len = k.got_;
+    outBytes_ += k.got_;
+    next_++;
+    held_ = true;
+    return(1);
+}
+
+/**
+ * Stop the worker, it is waiting for a buffer or finishing the block
+ * it has.
+ */
+void
+Decompressor::close()
+{
+    if (worker_.joinable()) {
+        {
+            lock_guard<mutex> g(lock_);
+            stop_ = true;
+            changed_.notify_all();
+        }
+        worker_.join();
+    }
+
+    if (fd_ >= 0 && ownsFd_)
+        ::close(fd_);
+    fd_ = -1;
+    ownsFd_ = false;
+    head_.clear();
+    inflater_.reset();
+    next_ = 0;
+    held_ = false;
+}
+
+int
+Decompressor::fail(const string& msg)
+{
+    error_ = msg;
+    ended_ = true;
+    changed_.notify_all();
+    return(-1);
+}
+
+/**
+ * Fill the buffers in order, each one once the caller gave it back.
+ * A block is handed over full, only the last one may be shorter.
+ */
+void
+Decompressor::workerLoop()
+{
+    vector<char> in(max(blockSize_, head_.size()));
+    memcpy(&in[0], head_.data(), head_.size());
+    const char *ip = &in[0];
+    size_t in_left = head_.size();
+    inBytes_ += in_left;
+    bool eof = false;
+    bool member_end = false;      /// run() finished a member or frame
+
+    for (uint64_t seq = 0; ; ++seq) {
+        block& k = blocks_[seq % blocks_.size()];
+        {
+            unique_lock<mutex> g(lock_);
+            changed_.wait(g, [&]() {
+                return stop_ || k.state_ == blockIdle;
+            });
+            if (stop_)
+                return;
+            k.state_ = blockBusy;
+        }
+
+        char *op = k.data_;
+        size_t room = blockSize_;
+        string msg;
+        while (room > 0) {
+            if (in_left == 0 && !eof) {
+                ssize_t n = ::read(fd_, &in[0], in.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0) {
+                    msg = string("read error ") + strerror(errno);
+                    break;
+                }
+                eof = (n == 0);
+                ip = &in[0];
+                in_left = n;
+                inBytes_ += n;
+            }
+            if (in_left == 0) {
+                if (!member_end)
+                    msg = "unexpected end of compressed input";
+                break;
+            }
+
+            if (member_end && *ip == 0) {
+                // tar and dd pad to a block with zeros, no member or
+                // frame starts with one: padding up to eof is the end.
+                while (in_left > 0 && *ip == 0) {
+                    ++ip;
+                    --in_left;
+                }
+                continue;
+            }
+            if (member_end && inflater_->reset() < 0) {
+                msg = inflater_->error();
+                break;
+            }
+            int ret = inflater_->run(&ip, &in_left, &op, &room);
+            if (ret < 0) {
+                msg = inflater_->error();
+                break;
+            }
+            member_end = (ret == 1);
+        }
+
+        lock_guard<mutex> g(lock_);
+        k.got_ = blockSize_ - room;
+        k.state_ = blockReady;
+        if (k.got_ > 0)
+            filled_++;
+        else
+            k.state_ = blockIdle;
+        if (!msg.empty()) {
+            fail(msg);
+            return;
+        }
+        if (room > 0) {
+            ended_ = true;
+            changed_.notify_all();
+            return;
+        }
+        changed_.notify_all();
+    }
+}
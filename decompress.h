@@ -0,0 +1,122 @@
+// -*- C++ -*-
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+enum class Codec : std::int8_t
+{
+    NONE = 0,         /// plain text
+    GZIP = 1,         /// 1f 8b, zlib
+    ZSTD = 2          /// 28 b5 2f fd, only with make ZSTD=1
+};
+
+/// Codec of a file that starts with these bytes, NONE if none matches.
+Codec codecOf(const unsigned char *magic, size_t len);
+/// Reads the first bytes of fname. Returns -1 if it cannot be read.
+int sniffCodec(const string& fname, Codec *codec, ostream& err = cerr);
+const char *codecName(Codec codec);
+
+/**
+ * One streaming codec. run() takes what it can from *in and writes what
+ * fits into *out, both are advanced past what was used.
+ * Returns 1 at the end of a gzip member or zstd frame, 0 when it wants
+ * more input or more room, -1 on corrupt input (see error()).
+ */
+class Inflater
+{
+public:
+    virtual ~Inflater() {}
+
+    virtual int run(const char **in, size_t *in_len, char **out,
+                    size_t *out_len) = 0;
+    /// Another member or frame follows the one run() finished.
+    virtual int reset() = 0;
+    virtual const char *error() const = 0;
+};
+
+/// NULL if codec is NONE or not built in.
+Inflater *newInflater(Codec codec);
+
+/**
+ * Decompresses a file on a thread of its own into a ring of depth
+ * blocks, the caller parses one block while the next ones are being
+ * decompressed. Same shape as ReadAhead:
+ *   Decompressor dz;
+ *   dz.open(fname);
+ *   while ((ret = dz.next(&buf, &len)) > 0) bt.feed(buf, len);
+ * Concatenated members (gzip) and frames (zstd) are read as one stream.
+ */
+class Decompressor
+{
+public:
+    explicit Decompressor(size_t block_size = 1 << 20,
+                          unsigned int depth = 4);
+    virtual ~Decompressor();
+
+    int open(const string& fname, ostream& err = cerr);
+    /**
+     * An fd that is already open and cannot seek (stdin). head is what
+     * was read off it to find the codec, it is decompressed first.
+     * The fd is left open.
+     */
+    int open(int fd, const string& name, const char *head,
+             size_t head_len, ostream& err = cerr);
+    /// The next decompressed block, valid until the next call.
+    /// Returns 1, 0 at the end of the input or -1 on a read or codec error.
+    int next(const char **buf, size_t *len);
+    void close();
+
+    Codec codec() const { return codec_; }
+    uint64_t inBytes() const { return inBytes_; }     /// compressed, read
+    uint64_t outBytes() const { return outBytes_; }   /// handed out
+
+private:
+    Decompressor(const Decompressor&);      /// no copies.
+    Decompressor& operator=(const Decompressor&);
+
+    struct block
+    {
+        char *data_;
+        size_t got_;
+        int state_;               /// see decompress.cc
+    };
+
+    int start(Codec codec);
+    void workerLoop();
+    int fail(const string& msg);  /// from the worker, under lock_
+
+    size_t blockSize_;
+    vector<block> blocks_;
+    string fname_;
+    ostream *err_;
+    int fd_;
+    bool ownsFd_;                 /// close() closes fd_
+    string head_;                 /// read before the worker started
+    Codec codec_;
+    unique_ptr<Inflater> inflater_;
+    uint64_t next_;               /// handed out next
+    bool held_;                   /// the caller has block next_ - 1
+    uint64_t inBytes_;            /// worker only
+    uint64_t outBytes_;
+
+    thread worker_;
+    mutex lock_;
+    condition_variable changed_;
+    uint64_t filled_;             /// blocks decompressed so far
+    bool ended_;                  /// no block after filled_ - 1
+    string error_;                /// why the worker stopped early
+    bool stop_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:descr_source.cc
+ * Reads descriptions back from the decoded file for trees that only
+ * kept where they are (topology only decode, see offset_payload).
+ */
+
+#include "descr_source.h"
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+
+void
+stampOf(const struct stat& sbuf, source_stamp_t *stamp)
+{
+    stamp->size_ = sbuf.st_size;
+    stamp->mtime_ = sbuf.st_mtim;
+}
+
+DescrSource::DescrSource()
+{
+}
+
+DescrSource::~DescrSource()
+{
+    close();
+}
+
+/**
+ * Map fname, which has to be the file the tree was decoded from: same
+ * size and not modified since, offsets into anything else are garbage.
+ */
+int
+DescrSource::open(const string& fname, const source_stamp_t& stamp,
+                  ostream& err)
+{
+    close();
+
+    struct stat sbuf;
+    memset(&sbuf, 0, sizeof(sbuf));
+    if (::stat(fname.c_str(), &sbuf) == -1) {
+        err << "stat Error for fname : " << fname << " "
+            << strerror(errno) << endl;
+        return(-1);
+    }
+
+    source_stamp_t now;
+    stampOf(sbuf, &now);
+    if (now.size_ != stamp.size_ ||
+        now.mtime_.tv_sec != stamp.mtime_.tv_sec ||
+        now.mtime_.tv_nsec != stamp.mtime_.tv_nsec) {
+        err << "fname : " << fname
+            << " changed since it was decoded" << endl;
+        return(-1);
+    }
+
+    if (file_.open(fname, err) < 0)
+        return(-1);
+    if (file_.size() != stamp.size_) {
+        err << "fname : " << fname
+            << " changed since it was decoded" << endl;
+        file_.close();
+        return(-1);
+    }
+    return(0);
+}
+
+void
+DescrSource::close()
+{
+    file_.close();
+}
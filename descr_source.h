@@ -0,0 +1,60 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mapped_file.h"
+using namespace std;
+
+#ifndef DESCR_SOURCE_H
+#define DESCR_SOURCE_H
+
+/**
+ * Size and modification time of a decoded file, taken when the decode
+ * starts. Descriptions that were left in the file are only read back
+ * if it still looks the same.
+ */
+typedef struct source_stamp
+{
+    uint64_t size_;
+    struct timespec mtime_;
+} source_stamp_t;
+
+void stampOf(const struct stat& sbuf, source_stamp_t *stamp);
+
+/**
+ * The decoded file, mapped again when a description kept as an offset
+ * (offset_payload) is asked for. Nothing is mapped until then and the
+ * pages are the page cache's, not the tree's.
+ */
+class DescrSource
+{
+public:
+    DescrSource();
+    virtual ~DescrSource();
+
+    /// Fails if fname changed since stamp was taken.
+    int open(const string& fname, const source_stamp_t& stamp,
+             ostream& err = cerr);
+    void close();
+    bool isOpen() const { return file_.isOpen(); }
+
+    /// Bytes [off, off + len) of the file or NULL past its end.
+    const char *at(uint64_t off, size_t len) const
+    {
+        if (off > file_.size() || len > file_.size() - off)
+            return NULL;
+        return file_.begin() + off;
+    }
+
+private:
+    DescrSource(const DescrSource&);            /// no copies.
+    DescrSource& operator=(const DescrSource&);
+
+    MappedFile file_;
+};
+
+#endif
@@ -0,0 +1,346 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+#ifndef FLAT_INDEX_H
+#define FLAT_INDEX_H
+
+/**
+ * murmur3 finalizer on all but the low 3 bits, runs of 8 consecutive
+ * ids land in neighbouring slots (dense ids stay cache friendly) while
+ * strided or clustered ids still get spread out.
+ */
+inline size_t
+flatHash(int32_t key)
+{
+    uint32_t h = (uint32_t)key >> 3;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return ((size_t)h << 3) | ((uint32_t)key & 7);
+}
+
+/// Same for 64 bit ids with the 64 bit finalizer.
+inline size_t
+flatHash(int64_t key)
+{
+    uint64_t h = (uint64_t)key >> 3;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (size_t)((h << 3) | ((uint64_t)key & 7));
+}
+
+inline size_t flatHash(uint32_t key) { return flatHash((int32_t)key); }
+inline size_t flatHash(uint64_t key) { return flatHash((int64_t)key); }
+
+/**
+ * Open addressing (linear probing) index keyed by node id, K is any
+ * integer type flatHash() takes.
+ * Every id owns one slot holding a small inline vector of V, the first
+ * entry lives in the slot itself and only duplicate ids (-d) spill into
+ * a heap vector. Entries keep their insertion order.
+ * Slot pointers are invalidated by insert(), never hold on to one.
+ */
+template <typename V, typename K = int>
+class FlatIndex
+{
+public:
+    struct slot
+    {
+        K key_;
+        unsigned int count_;      /// 0 means the slot is empty.
+        V first_;
+        vector<V> *more_;         /// entries after the first one.
+
+        unsigned int size() const { return count_; }
+        V& at(unsigned int i) { return (i == 0 ? first_ : (*more_)[i - 1]); }
+        const V& at(unsigned int i) const
+        {
+            return (i == 0 ? first_ : (*more_)[i - 1]);
+        }
+
+        void push_back(const V& v)
+        {
+            if (count_ == 0) {
+                first_ = v;
+            } else {
+                if (!more_)
+                    more_ = new vector<V>;
+                more_->push_back(v);
+            }
+            count_++;
+        }
+
+        /// Drop the last entry, one of several (erase() the last one).
+        void pop_back()
+        {
+            more_->pop_back();
+            count_--;
+        }
+    };
+
+    explicit FlatIndex(size_t capacity = 1024)
+        : slots_(NULL),
+          mask_(0),
+          size_(0),
+          probes_(0)
+    {
+        size_t cap = 16;
+        while (cap < capacity)
+            cap <<= 1;
+        allocate(cap);
+    }
+
+    virtual ~FlatIndex()
+    {
+        clear();
+        delete [] slots_;
+    }
+
+    /// Slot for key or NULL.
+    slot *find(K key)
+    {
+        size_t i = hash(key) & mask_;
+        for (;; i = (i + 1) & mask_) {
+            probes_++;
+            slot& s = slots_[i];
+            if (s.count_ == 0)
+                return NULL;
+            if (s.key_ == key)
+                return &s;
+        }
+    }
+
+    /**
+     * find() for readers, probes are not counted so nothing is written
+     * and any number of threads may look up at the same time.
+     */
+    const slot *lookup(K key) const
+    {
+        size_t i = hash(key) & mask_;
+        for (;; i = (i + 1) & mask_) {
+            const slot& s = slots_[i];
+            if (s.count_ == 0)
+                return NULL;
+            if (s.key_ == key)
+                return &s;
+        }
+    }
+
+    /// Slot for key, created (empty until push_back()) when missing.
+    slot *insert(K key)
+    {
+        if ((size_ + 1) * 2 > mask_ + 1)
+            grow();
+
+        size_t i = hash(key) & mask_;
+        for (;; i = (i + 1) & mask_) {
+            probes_++;
+            slot& s = slots_[i];
+            if (s.count_ == 0) {
+                s.key_ = key;
+                size_++;
+                return &s;
+            }
+            if (s.key_ == key)
+                return &s;
+        }
+    }
+
+    /**
+     * Drop a used slot. Later slots of the probe run are shifted back
+     * so find() never needs tombstones.
+     */
+    void erase(slot *s)
+    {
+        delete s->more_;
+        s->more_ = NULL;
+        s->count_ = 0;
+        size_--;
+
+        size_t hole = s - slots_;
+        for (size_t j = (hole + 1) & mask_; slots_[j].count_ != 0;
+             j = (j + 1) & mask_) {
+            // j may fill the hole only if its home is not in (hole, j].
+            size_t home = hash(slots_[j].key_) & mask_;
+            if (((j - home) & mask_) >= ((j - hole) & mask_)) {
+                slots_[hole] = slots_[j];
+                slots_[j].count_ = 0;
+                slots_[j].more_ = NULL;
+                hole = j;
+            }
+        }
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }           /// distinct ids.
+    size_t capacity() const { return mask_ + 1; }
+    uint64_t probes() const { return probes_; }      /// by find(), insert()
+
+    /// Walk all used slots, order is unspecified.
+    template <typename F>
+    void forEach(F fn)
+    {
+        for (size_t i = 0; i <= mask_; ++i) {
+            if (slots_[i].count_ != 0)
+                fn(slots_[i]);
+        }
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i <= mask_; ++i) {
+            delete slots_[i].more_;
+            slots_[i].more_ = NULL;
+            slots_[i].count_ = 0;
+        }
+        size_ = 0;
+    }
+
+    void reserve(size_t n)
+    {
+        while (n * 2 > mask_ + 1)
+            grow();
+    }
+
+private:
+    FlatIndex(const FlatIndex&);            /// no copies.
+    FlatIndex& operator=(const FlatIndex&);
+
+    static size_t hash(K key)
+    {
+        return flatHash(key);
+    }
+
+    void allocate(size_t cap)
+    {
+        slots_ = new slot[cap];
+        for (size_t i = 0; i < cap; ++i) {
+            slots_[i].count_ = 0;
+            slots_[i].more_ = NULL;
+        }
+        mask_ = cap - 1;
+    }
+
+    void grow()
+    {
+        slot *old = slots_;
+        size_t old_cap = mask_ + 1;
+        allocate(old_cap * 2);
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].count_ == 0)
+                continue;
+            size_t j = hash(old[i].key_) & mask_;
+            while (slots_[j].count_ != 0)
+                j = (j + 1) & mask_;
+            slots_[j] = old[i];
+        }
+        delete [] old;
+    }
+
+    slot *slots_;
+    size_t mask_;                 /// capacity - 1, capacity is a power of 2.
+    size_t size_;
+    uint64_t probes_;
+};
+
+/**
+ * Set of ids only, linear probing like FlatIndex but a slot is just the
+ * key and one bit saying it is used. For ids that have to be remembered
+ * long after their entries were dropped. No erase().
+ */
+template <typename K = int>
+class FlatIdSet
+{
+public:
+    explicit FlatIdSet(size_t capacity = 1024)
+        : mask_(0),
+          size_(0)
+    {
+        size_t cap = 64;
+        while (cap < capacity)
+            cap <<= 1;
+        allocate(cap);
+    }
+
+    virtual ~FlatIdSet() {}
+
+    bool contains(K key) const
+    {
+        size_t i = flatHash(key) & mask_;
+        for (; used(i); i = (i + 1) & mask_) {
+            if (keys_[i] == key)
+                return true;
+        }
+        return false;
+    }
+
+    /// false if key was there already.
+    bool insert(K key)
+    {
+        if ((size_ + 1) * 2 > mask_ + 1)
+            grow();
+
+        size_t i = flatHash(key) & mask_;
+        for (; used(i); i = (i + 1) & mask_) {
+            if (keys_[i] == key)
+                return false;
+        }
+        keys_[i] = key;
+        used_[i >> 6] |= 1ULL << (i & 63);
+        size_++;
+        return true;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    void clear()
+    {
+        used_.assign(used_.size(), 0);
+        size_ = 0;
+    }
+
+private:
+    bool used(size_t i) const { return (used_[i >> 6] >> (i & 63)) & 1; }
+
+    void allocate(size_t cap)
+    {
+        keys_.assign(cap, K());
+        used_.assign(cap / 64, 0);
+        mask_ = cap - 1;
+    }
+
+    void grow()
+    {
+        vector<K> old_keys;
+        vector<uint64_t> old_used;
+        old_keys.swap(keys_);
+        old_used.swap(used_);
+        allocate(old_keys.size() * 2);
+        for (size_t i = 0; i < old_keys.size(); ++i) {
+            if (!((old_used[i >> 6] >> (i & 63)) & 1))
+                continue;
+            size_t j = flatHash(old_keys[i]) & mask_;
+            while (used(j))
+                j = (j + 1) & mask_;
+            keys_[j] = old_keys[i];
+            used_[j >> 6] |= 1ULL << (j & 63);
+        }
+    }
+
+    vector<K> keys_;
+    vector<uint64_t> used_;       /// bit per slot
+    size_t mask_;                 /// capacity - 1, capacity is a power of 2.
+    size_t size_;
+};
+
+#endif
@@ -1,48 +1,485 @@
 // -*- C++ -*-
 
 #include "build_tree.h"
+#include "batch_decode.h"
+#include "decompress.h"
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <thread>
 
 using namespace std;
 
+const uint64_t largeFSize = 1ULL << 40;      /// -L file limit, 1 TB
+const size_t largeLineSize = 16 * 1024 * 1024; /// -L line limit
+const size_t skippedShown = 20;               /// -k summary lines
+
+static void
+usage(const char *prog)
+{
+    cerr << "usage: " << prog
+         << "[ -f <filename>|-(plain, gzip or zstd) "
+         << "-i(support incomplete tree) "
+         << "-d(support duplicate ids) -m(mmap input) "
+         << "-a(read ahead, io_uring or a reader thread) "
+         << "-t <threads>(parallel parse and print, implies -m) "
+         << "-p(parallel stitch, with -t) "
+         << "-w <snapshot out> | -r <snapshot in> "
+         << "-s(stats as JSON on stderr) "
+         << "-L(large input, read in blocks, 1 TB / 16 MB line limit) "
+         << "-k(skip records that do not fit, keep the biggest tree) "
+         << "-q <id pairs>(print lca and path length, -t threads) "
+         << "-u <changes>(+ add, - remove, = replace records) "
+         << "-v <file>(check against a fresh decode of file) "
+         << "-c <bfs|pre|veb>(traverse a compact copy) "
+         << "-M <manifest>(file per line, several -f work too) "
+         << "-j <workers>(files decoded at once) "
+         << "-T <off|none>(topology only, descriptions read back "
+         << "from the file or dropped)]"
+         << endl;
+}
+
+/**
+ * -f -: the first bytes tell plain text from gzip or zstd, compressed
+ * input is decompressed on a thread of its own like a compressed file.
+ */
+static int
+decodeStdin(BuildTree& bt)
+{
+    char buf[64 * 1024];
+    size_t head = 0;
+    bool eof = false;
+    // enough for the longest magic, a pipe may hand out less at a time.
+    while (head < 4 && !eof) {
+        ssize_t n = read(STDIN_FILENO, buf + head, sizeof(buf) - head);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            cerr << "read error on stdin : " << strerror(errno) << endl;
+            return(-1);
+        }
+        eof = (n == 0);
+        head += n;
+    }
+
+    if (codecOf((const unsigned char *)buf, head) != Codec::NONE) {
+        Decompressor dz;
+        if (dz.open(STDIN_FILENO, "stdin", buf, head) < 0)
+            return(-1);
+        const char *p = NULL;
+        size_t len = 0;
+        int ret;
+        while ((ret = dz.next(&p, &len)) > 0) {
+            if (bt.feed(p, len) < 0)
+                return(-1);
+        }
+        return (ret < 0 ? -1 : bt.finish());
+    }
+
+    if (head > 0 && bt.feed(buf, head) < 0)
+        return(-1);
+    while (!eof) {
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            cerr << "read error on stdin : " << strerror(errno) << endl;
+            return(-1);
+        }
+        if (bt.feed(buf, n) < 0)
+            return(-1);
+    }
+    return bt.finish();
+}
+
+/**
+ * -q: one "<id> <id>" pair per line, answered with
+ * "<id> <id> <lca id> <path length>" ("none none" for an unknown id).
+ */
+static int
+answerQueries(BuildTree& bt, const string& qname, unsigned int threads)
+{
+    ifstream in(qname.c_str());
+    if (!in) {
+        cerr << qname << " : error in open " << endl;
+        return(-1);
+    }
+
+    vector<lca_query_t> queries;
+    lca_query_t q;
+    while (in >> q.a_ >> q.b_)
+        queries.push_back(q);
+    if (!in.eof()) {
+        cerr << qname << " : bad query after pair " << queries.size() << endl;
+        return(-1);
+    }
+
+    if (bt.prepareQuery(true) < 0)
+        return(-1);
+
+    vector<lca_answer_t> answers;
+    bt.query().lcaBatch(queries, answers, threads);
+
+    FdSink out(STDOUT_FILENO);
+    BufferedWriter w(out);
+    char buf[64];
+    for (size_t i = 0; i < queries.size(); ++i) {
+        int len;
+        if (answers[i].lca_ == queryNone)
+            len = snprintf(buf, sizeof(buf), "%d %d none none\n",
+                           queries[i].a_, queries[i].b_);
+        else
+            len = snprintf(buf, sizeof(buf), "%d %d %d %u\n",
+                           queries[i].a_, queries[i].b_,
+                           bt.query().id(answers[i].lca_), answers[i].dist_);
+        w.append(buf, len);
+    }
+    return (w.flush() < 0 ? -1 : 0);
+}
+
+/**
+ * -u: one change per line, "+ <record>" adds, "- <id>" removes and
+ * "= <record>" replaces, see build_tree_update.cc.
+ */
+static int
+applyUpdates(BuildTree& bt, const string& uname)
+{
+    ifstream in(uname.c_str());
+    if (!in) {
+        cerr << uname << " : error in open " << endl;
+        return(-1);
+    }
+
+    int line_count = 0;
+    for (string line; getline(in, line); ) {
+        line_count++;
+        if (line.length() == 0)
+            continue;
+
+        int ret = -1;
+        const char *rec = line.c_str() + 1;
+        size_t len = line.length() - 1;
+        while (len > 0 && *rec == ' ') {
+            rec++;
+            len--;
+        }
+        switch (line[0]) {
+        case '+': ret = bt.addRecord(rec, len); break;
+        case '=': ret = bt.replaceRecord(rec, len); break;
+        case '-': {
+            // just the id, held to the same rules as the ids of a record.
+            string tok(rec, len);
+            tok.erase(tok.find_last_not_of(" \t\r") + 1);
+            int id = 0;
+            if (parseNumber(tok.c_str(), &id))
+                ret = bt.removeRecord(id);
+            else
+                cerr << "expected an id" << endl;
+            break;
+        }
+        default:
+            cerr << "expected +, - or =" << endl;
+            break;
+        }
+        if (ret < 0) {
+            cerr << line_count << " : Error update - " << line << endl;
+            return(-1);
+        }
+    }
+
+    if (bt.waitCount() > 0) {
+        cerr << "Error - unresolved node count after updates : "
+             << bt.waitCount() << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+static int
+parseLayout(const string& name, Layout& l)
+{
+    if (name == "bfs") {
+        l = Layout::BFS;
+    } else if (name == "pre") {
+        l = Layout::PREORDER;
+    } else if (name == "veb") {
+        l = Layout::VEB;
+    } else {
+        cerr << "unknown layout : " << name << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ * -T: decode for the shape only. "off" keeps where each description is
+ * and reads them back from the file to print, "none" drops them and
+ * prints the ids instead. -t only prints in parallel here.
+ */
+template <typename Payload>
+static int
+decodeTopology(const string& fname, bool complete, bool dup_ids,
+               InputMode mode, bool large, int threads, bool skip,
+               bool stats)
+{
+    BasicBuildTree<int, Payload> bt(fname, complete, dup_ids);
+    bt.setInputMode(mode);
+    bt.setPrintThreads(threads > 0 ? threads : 1);
+    bt.setSkipBad(skip);
+    bt.enableStats(stats);
+    if (large) {
+        bt.setLargeInput(true);
+        bt.setMaxFileSize(largeFSize);
+        bt.setMaxLineSize(largeLineSize);
+    }
+    int ret = bt.decodeFile();
+    if (skip)
+        bt.errors().printSummary(cerr, skippedShown);
+    if (ret < 0) {
+        cerr << "Error decoding file." << endl;
+        return(-1);
+    }
+
+    bt.printBFS();
+
+    bt.printDFS();
+
+    if (stats)
+        printStatsJson(cerr, bt.stats());
+    return(0);
+}
+
+/**
+ * -M and/or several -f: decode them all on -j workers (default one per
+ * cpu), see batch_decode.h. Options that act on one tree are refused.
+ */
+static int
+decodeFiles(vector<string>& files, const string& manifest, int jobs,
+            bool complete, bool dup_ids, InputMode mode, bool large,
+            bool skip, bool stats, const string& layout, bool single_only)
+{
+    if (single_only) {
+        cerr << "-t, -p, -w, -q, -u, -v and -T take a single -f" << endl;
+        return(-1);
+    }
+    if (manifest.length() != 0 && readManifest(manifest, files) < 0)
+        return(-1);
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i] == "-") {
+            cerr << "stdin cannot be part of a batch" << endl;
+            return(-1);
+        }
+    }
+
+    batch_options_t opts;
+    opts.complete_ = complete;
+    opts.dupIds_ = dup_ids;
+    opts.mode_ = mode;
+    opts.large_ = large;
+    opts.maxFSize_ = largeFSize;
+    opts.maxLineSize_ = largeLineSize;
+    opts.compact_ = (layout.length() != 0);
+    opts.layout_ = Layout::BFS;
+    opts.skipBad_ = skip;
+    opts.stats_ = stats;
+    if (opts.compact_ && parseLayout(layout, opts.layout_) < 0)
+        return(-1);
+
+    if (jobs <= 0)
+        jobs = thread::hardware_concurrency();
+
+    cout.flush();
+    FdSink out(STDOUT_FILENO);
+    size_t failed = decodeBatch(files, jobs, opts, out, cerr);
+    if (failed > 0) {
+        cerr << "Error decoding " << failed << " of " << files.size()
+             << " files." << endl;
+        return(-1);
+    }
+    return(0);
+}
+
 int main(int argc, char *argv[])
 {
     string fname("");
     bool complete = true;
     bool dup_ids = false;
     bool got_file = false;
+    InputMode mode = InputMode::STREAM;
+    int threads = 1;
+    bool sharded = false;
+    string snap_out("");
+    string snap_in("");
+    bool stats = false;
+    bool large = false;
+    bool skip = false;
+    string queries("");
+    string updates("");
+    string fresh("");
+    string layout("");
+    vector<string> files;
+    string manifest("");
+    int jobs = 0;
+    string topology("");
     int c;
-    while ((c = getopt (argc, argv, "hdif:")) != -1)
+    while ((c = getopt (argc, argv, "hdimapksLf:t:w:r:q:u:v:c:M:j:T:")) != -1)
     switch (c) {
-    case 'f': got_file = true; fname = optarg; break;
+    case 'f':
+        got_file = true;
+        fname = optarg;
+        files.push_back(fname);
+        break;
+    case 'M': manifest = optarg; break;
+    case 'j': jobs = atoi(optarg); break;
+    case 'w': snap_out = optarg; break;
+    case 'r': snap_in = optarg; break;
     case 'd': dup_ids = true; break;
     case 'i': complete = false; break;
+    case 'm': mode = InputMode::MMAP; break;
+    case 'a': mode = InputMode::ASYNC; break;
+    case 't': threads = atoi(optarg); break;
+    case 'p': sharded = true; break;
+    case 's': stats = true; break;
+    case 'L': large = true; break;
+    case 'k': skip = true; break;
+    case 'q': queries = optarg; break;
+    case 'u': updates = optarg; break;
+    case 'v': fresh = optarg; break;
+    case 'c': layout = optarg; break;
+    case 'T': topology = optarg; break;
     case '?':
     case 'h':
     default:
-        cerr << "usage: " << argv[0]
-             << "[ -f <filename> -i(support incomplete tree) "
-             << "-d(support duplicate ids]" << endl;
+        usage(argv[0]);
         return(-1);
     }
 
+    if (snap_in.length() != 0) {
+        BuildTree snap;
+        if (snap.loadSnapshot(snap_in) < 0) {
+            cerr << "Error loading snapshot." << endl;
+            return(-1);
+        }
+
+        snap.printBFS();
+
+        snap.printDFS();
+
+        return(0);
+    }
+
+    if (manifest.length() != 0 || files.size() > 1)
+        return decodeFiles(files, manifest, jobs, complete, dup_ids, mode,
+                           large, skip, stats, layout,
+                           threads > 1 || sharded ||
+                           snap_out.length() != 0 || queries.length() != 0 ||
+                           updates.length() != 0 || fresh.length() != 0 ||
+                           topology.length() != 0);
+
     if (!got_file) {
-        cerr << "usage: " << argv[0]
-             << "[ -f <filename> -i(support incomplete tree) "
-             << "-d(support duplicate ids]" << endl;
+        usage(argv[0]);
+        return(-1);
+    }
+
+    if (topology.length() != 0) {
+        if (fname == "-" || sharded || snap_out.length() != 0 ||
+            queries.length() != 0 || updates.length() != 0 ||
+            fresh.length() != 0 || layout.length() != 0) {
+            cerr << "-T takes a file, not -, and none of -p, -w, -q, "
+                 << "-u, -v and -c" << endl;
+            return(-1);
+        }
+        if (topology == "off")
+            return decodeTopology<offset_payload>(fname, complete, dup_ids,
+                                                  mode, large, threads,
+                                                  skip, stats);
+        if (topology == "none")
+            return decodeTopology<no_payload>(fname, complete, dup_ids,
+                                              mode, large, threads, skip,
+                                              stats);
+        cerr << "unknown topology mode : " << topology << endl;
+        return(-1);
+    }
+
+    if (skip && updates.length() != 0) {
+        cerr << "-k and -u do not go together" << endl;
         return(-1);
     }
 
     BuildTree bt(fname, complete, dup_ids);
-    if (bt.decodeFile() < 0) {
-        cerr << "Error decoding file." << endl;
+    bt.setInputMode(mode);
+    bt.setThreads(threads > 0 ? threads : 1);
+    bt.setShardedStitch(sharded);
+    bt.setSkipBad(skip);
+    bt.enableStats(stats);
+    if (large) {
+        bt.setLargeInput(true);
+        bt.setMaxFileSize(largeFSize);
+        bt.setMaxLineSize(largeLineSize);
+    }
+    if (fname == "-") {
+        // -f - : decode whatever arrives on stdin.
+        int ret = decodeStdin(bt);
+        if (skip)
+            bt.errors().printSummary(cerr, skippedShown);
+        if (ret < 0) {
+            cerr << "Error decoding stdin." << endl;
+            return(-1);
+        }
+    } else {
+        int ret = bt.decodeFile();
+        if (skip)
+            bt.errors().printSummary(cerr, skippedShown);
+        if (ret < 0) {
+            cerr << "Error decoding file." << endl;
+            return(-1);
+        }
+    }
+
+    if (updates.length() != 0 && applyUpdates(bt, updates) < 0) {
+        cerr << "Error applying updates." << endl;
         return(-1);
     }
 
-    bt.printBFS();
+    if (fresh.length() != 0 && bt.validate(fresh) < 0) {
+        cerr << "Error validating against " << fresh << "." << endl;
+        return(-1);
+    }
 
-    bt.printDFS();
+    if (layout.length() != 0) {
+        Layout l = Layout::BFS;
+        if (parseLayout(layout, l) < 0)
+            return(-1);
+        if (bt.compact(l) < 0) {
+            cerr << "Error compacting tree." << endl;
+            return(-1);
+        }
+    }
+
+    if (snap_out.length() != 0 && bt.saveSnapshot(snap_out) < 0) {
+        cerr << "Error writing snapshot." << endl;
+        return(-1);
+    }
+
+    if (queries.length() != 0) {
+        if (answerQueries(bt, queries, threads > 0 ? threads : 1) < 0) {
+            cerr << "Error answering queries." << endl;
+            return(-1);
+        }
+    } else {
+        bt.printBFS();
+
+        bt.printDFS();
+    }
+
+    if (stats)
+        printStatsJson(cerr, bt.stats());
 
     return(0);
 }
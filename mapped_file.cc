@@ -0,0 +1,128 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:mapped_file.cc
+ * mmap() backed input for BuildTree, lets the line scanner tokenize the
+ * file in place instead of copying every line through an fstream.
+ */
+
+#include "mapped_file.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+
+using namespace std;
+
+MappedFile::MappedFile()
+    : fd_(-1),
+      data_(NULL),
+      size_(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/**
+ * Map the file read only, an empty file is a valid (empty) mapping.
+ * Failures are reported on err.
+ */
+int
+MappedFile::open(const string& fname, ostream& err)
+{
+    close();
+
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err << fname << " : error in open "
+            << strerror(errno) << endl;
+        return(-1);
+    }
+
+    struct stat sbuf;
+    memset(&sbuf, 0, sizeof(sbuf));
+    if (::fstat(fd, &sbuf) == -1) {
+        err << "fstat Error for fname : " << fname << " "
+            << strerror(errno) << endl;
+        ::close(fd);
+        return(-1);
+    }
+
+    fd_ = fd;
+    size_ = sbuf.st_size;
+    if (size_ == 0)
+        return(0);
+
+    void *addr = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        err << "mmap Error for fname : " << fname << " "
+            << strerror(errno) << endl;
+        close();
+        return(-1);
+    }
+
+    // we walk the file front to back exactly once.
+    ::madvise(addr, size_, MADV_SEQUENTIAL);
+    data_ = (const char *)addr;
+    return(0);
+}
+
+void
+MappedFile::close()
+{
+    if (data_) {
+        ::munmap((void *)data_, size_);
+        data_ = NULL;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
+
+/**
+ * MADV_DONTNEED on the whole pages before p. Nothing was written to the
+ * private mapping so they are simply read in again should anyone look.
+ */
+void
+MappedFile::dropBefore(const char *p)
+{
+    if (!data_ || p <= data_)
+        return;
+
+    size_t page = ::sysconf(_SC_PAGESIZE);
+    size_t len = (p - data_) / page * page;
+    if (len > 0)
+        ::madvise((void *)data_, len, MADV_DONTNEED);
+}
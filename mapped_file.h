@@ -0,0 +1,40 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+/**
+ * Read only memory mapping of a whole file. Lines are consumed in
+ * place hence the mapping has to outlive every node that points into it.
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    virtual ~MappedFile();
+
+    int open(const string& fname, ostream& err = cerr);
+    void close();
+    /// The pages before p are not read again, unmapped from us.
+    void dropBefore(const char *p);
+
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+    bool isOpen() const { return fd_ >= 0; }
+
+private:
+    MappedFile(const MappedFile&);            /// no copies.
+    MappedFile& operator=(const MappedFile&);
+
+    int fd_;
+    const char *data_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,155 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:out_writer.cc
+ * Bulk output for traversal results, replaces per node cout << calls.
+ */
+
+#include "out_writer.h"
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+using namespace std;
+
+int
+OutputSink::writev(const struct iovec *iov, int cnt)
+{
+    for (int i = 0; i < cnt; ++i) {
+        if (write((const char *)iov[i].iov_base, iov[i].iov_len) < 0)
+            return(-1);
+    }
+    return(0);
+}
+
+int
+FdSink::write(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(fd_, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return(-1);
+        }
+        buf += n;
+        len -= n;
+    }
+    return(0);
+}
+
+/**
+ * Keeps going after a short writev(), the iovec copy is ours to modify.
+ */
+int
+FdSink::writev(const struct iovec *iov, int cnt)
+{
+    struct iovec v[IOV_MAX];
+    if (cnt > IOV_MAX)
+        return OutputSink::writev(iov, cnt);
+
+    for (int i = 0; i < cnt; ++i)
+        v[i] = iov[i];
+
+    struct iovec *cur = v;
+    while (cnt > 0) {
+        ssize_t n = ::writev(fd_, cur, cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return(-1);
+        }
+
+        while (cnt > 0 && (size_t)n >= cur->iov_len) {
+            n -= cur->iov_len;
+            cur++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            cur->iov_base = (char *)cur->iov_base + n;
+            cur->iov_len -= n;
+        }
+    }
+    return(0);
+}
+
+int
+OstreamSink::write(const char *buf, size_t len)
+{
+    os_.write(buf, len);
+    return (os_ ? 0 : -1);
+}
+
+int
+StringSink::write(const char *buf, size_t len)
+{
+    out_.append(buf, len);
+    return(0);
+}
+
+BufferedWriter::BufferedWriter(OutputSink& sink, size_t capacity)
+    : sink_(sink),
+      buf_(new char[capacity]),
+      cap_(capacity),
+      used_(0),
+      failed_(false)
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    flush();
+    delete [] buf_;
+}
+
+int
+BufferedWriter::flush()
+{
+    if (used_ > 0 && !failed_ && sink_.write(buf_, used_) < 0)
+        failed_ = true;
+    used_ = 0;
+    return (failed_ ? -1 : 0);
+}
+
+void
+BufferedWriter::appendSlow(const char *buf, size_t len)
+{
+    if (len <= cap_ / 2) {
+        flush();
+        memcpy(buf_, buf, len);
+        used_ = len;
+        return;
+    }
+
+    // big piece, send it along with what we have, no copy.
+    struct iovec iov[2];
+    iov[0].iov_base = buf_;
+    iov[0].iov_len = used_;
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+    if (!failed_ && sink_.writev(iov, 2) < 0)
+        failed_ = true;
+    used_ = 0;
+}
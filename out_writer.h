@@ -0,0 +1,112 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <sys/uio.h>
+using namespace std;
+
+#ifndef OUT_WRITER_H
+#define OUT_WRITER_H
+
+/**
+ * Where traversal output ends up. write()/writev() return 0 or -1.
+ */
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+
+    virtual int write(const char *buf, size_t len) = 0;
+    virtual int writev(const struct iovec *iov, int cnt);
+};
+
+/**
+ * Straight to a file descriptor with write(2)/writev(2).
+ */
+class FdSink : public OutputSink
+{
+public:
+    explicit FdSink(int fd) : fd_(fd) {}
+
+    virtual int write(const char *buf, size_t len);
+    virtual int writev(const struct iovec *iov, int cnt);
+
+private:
+    int fd_;
+};
+
+/**
+ * For callers that want an ostream (or a stringstream in tests).
+ */
+class OstreamSink : public OutputSink
+{
+public:
+    explicit OstreamSink(ostream& os) : os_(os) {}
+
+    virtual int write(const char *buf, size_t len);
+
+private:
+    ostream& os_;
+};
+
+/**
+ * Collects into a string, handy for batching output per file.
+ */
+class StringSink : public OutputSink
+{
+public:
+    virtual int write(const char *buf, size_t len);
+
+    string& str() { return out_; }
+
+private:
+    string out_;
+};
+
+/**
+ * Formats into one large reusable buffer and hands it to the sink when
+ * full. A piece bigger than half the buffer goes out together with the
+ * buffered bytes in one writev() instead of being copied.
+ */
+class BufferedWriter
+{
+public:
+    explicit BufferedWriter(OutputSink& sink, size_t capacity = 1 << 20);
+    virtual ~BufferedWriter();
+
+    void append(const char *buf, size_t len)
+    {
+        if (len <= cap_ - used_) {
+            memcpy(buf_ + used_, buf, len);
+            used_ += len;
+            return;
+        }
+        appendSlow(buf, len);
+    }
+
+    void put(char c)
+    {
+        if (used_ == cap_)
+            flush();
+        buf_[used_++] = c;
+    }
+
+    int flush();
+    bool failed() const { return failed_; }
+
+private:
+    BufferedWriter(const BufferedWriter&);  /// no copies.
+    BufferedWriter& operator=(const BufferedWriter&);
+
+    void appendSlow(const char *buf, size_t len);
+
+    OutputSink& sink_;
+    char *buf_;
+    size_t cap_;
+    size_t used_;
+    bool failed_;                 /// sticky, the sink refused a write
+};
+
+#endif
@@ -0,0 +1,109 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:parallel_traverse.cc
+ * The ordered writer under the parallel printBFS()/printDFS(), see
+ * parallel_traverse.h.
+ */
+
+#include "parallel_traverse.h"
+#include <condition_variable>
+#include <mutex>
+
+using namespace std;
+
+const size_t orderedWindowPerThread = 4;  /// chunks a worker may run ahead
+
+int
+writeOrdered(size_t count, unsigned int threads, OutputSink& sink,
+             const function<void(size_t, string&)>& fill)
+{
+    size_t window = (threads == 0 ? 1 : threads) * orderedWindowPerThread;
+    vector<string> outs(window);
+    vector<char> ready(window, 0);
+    mutex lock;
+    condition_variable changed;
+    size_t next = 0;              /// next chunk to hand out
+    size_t written = 0;           /// chunks gone to the sink
+    bool failed = false;
+
+    // chunk i may only start once i - window is written, its slot is
+    // i % window.
+    auto worker = [&]() {
+        string buf;
+        for (;;) {
+            size_t i = 0;
+            {
+                unique_lock<mutex> g(lock);
+                changed.wait(g, [&]() {
+                    return (failed || next >= count ||
+                            next < written + window);
+                });
+                if (failed || next >= count)
+                    return;
+                i = next++;
+            }
+
+            buf.clear();
+            fill(i, buf);
+            {
+                lock_guard<mutex> g(lock);
+                outs[i % window].swap(buf);
+                ready[i % window] = 1;
+            }
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> pool;
+    size_t workers = min((size_t)(threads == 0 ? 1 : threads), count);
+    for (size_t w = 0; w < workers; ++w)
+        pool.push_back(thread(worker));
+
+    string out;
+    for (size_t i = 0; i < count; ++i) {
+        {
+            unique_lock<mutex> g(lock);
+            changed.wait(g, [&]() { return ready[i % window] != 0; });
+            out.swap(outs[i % window]);
+            ready[i % window] = 0;
+        }
+
+        int ret = sink.write(out.data(), out.size());
+        {
+            lock_guard<mutex> g(lock);
+            written++;
+            if (ret < 0)
+                failed = true;
+        }
+        changed.notify_all();
+        if (ret < 0)
+            break;
+    }
+
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+    return (failed ? -1 : 0);
+}
@@ -0,0 +1,347 @@
+// -*- C++ -*-
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "out_writer.h"
+#include "traverse.h"
+using namespace std;
+
+#ifndef PARALLEL_TRAVERSE_H
+#define PARALLEL_TRAVERSE_H
+
+/**
+ * printBFS()/printDFS() on several threads, the bytes are exactly what
+ * the serial traversals (traverse.h) write. print(out, node) writes one
+ * node and its separator; it is called from the worker threads and
+ * must only read the node.
+ *   printLevelOrder(root, 8, sink, print);
+ *   printInOrder(root, 8, sink, print);
+ * Work is cut into chunks printed into buffers of their own, and
+ * writeOrdered() hands the buffers to the sink in traversal order.
+ */
+
+const size_t levelParallelMin = 1 << 14;   /// narrower levels stay serial
+const size_t levelChunkSize = 1 << 13;     /// nodes per BFS chunk
+const uint64_t inOrderGrain = 1 << 14;     /// nodes per DFS chunk
+const unsigned int sizeTopDepth = 32;      /// see topLevels()
+const size_t sizeTasksPerThread = 8;
+const size_t chunkWriterSize = 64 * 1024;  /// BufferedWriter per chunk
+
+/**
+ * fill(i, out) for every i in [0, count) on up to threads threads,
+ * each out goes to sink in order of i. Workers run at most a few
+ * chunks ahead of the sink, so memory is bounded by that window and
+ * not by the output.
+ * Returns -1 if the sink failed, chunks not started by then are skipped.
+ */
+int writeOrdered(size_t count, unsigned int threads, OutputSink& sink,
+                 const function<void(size_t, string&)>& fill);
+
+/**
+ * Level by level. A level is split into chunks that are printed in
+ * parallel, each chunk collects the children of its nodes in order so
+ * the next level is the chunks' children concatenated.
+ */
+template <typename N, typename F>
+void
+printLevelOrder(const N *root, unsigned int threads, OutputSink& sink,
+                F print)
+{
+    BufferedWriter out(sink);
+    vector<const N *> level;
+    vector<const N *> next;
+    if (root)
+        level.push_back(root);
+
+    while (!level.empty()) {
+        next.clear();
+        if (threads <= 1 || level.size() < levelParallelMin) {
+            for (size_t i = 0; i < level.size(); ++i) {
+                const N *t = level[i];
+                print(out, t);
+                if (t->left_)
+                    next.push_back(t->left_);
+                if (t->right_)
+                    next.push_back(t->right_);
+            }
+            level.swap(next);
+            continue;
+        }
+
+        out.flush();
+        size_t chunks = (level.size() + levelChunkSize - 1) / levelChunkSize;
+        vector<vector<const N *> > kids(chunks);
+        writeOrdered(chunks, threads, sink,
+                     [&](size_t c, string& s) {
+            StringSink ss;
+            {
+                BufferedWriter w(ss, chunkWriterSize);
+                size_t end = min(level.size(), (c + 1) * levelChunkSize);
+                vector<const N *>& mine = kids[c];
+                mine.reserve(2 * (end - c * levelChunkSize));
+                for (size_t i = c * levelChunkSize; i < end; ++i) {
+                    const N *t = level[i];
+                    print(w, t);
+                    if (t->left_)
+                        mine.push_back(t->left_);
+                    if (t->right_)
+                        mine.push_back(t->right_);
+                }
+            }
+            s.swap(ss.str());
+        });
+
+        size_t total = 0;
+        for (size_t c = 0; c < chunks; ++c)
+            total += kids[c].size();
+        next.reserve(total);
+        for (size_t c = 0; c < chunks; ++c) {
+            next.insert(next.end(), kids[c].begin(), kids[c].end());
+            vector<const N *>().swap(kids[c]);
+        }
+        level.swap(next);
+    }
+
+    out.put('\n');
+}
+
+/// A node with more than grain nodes under it, see countSubtree().
+typedef struct big_node
+{
+    uint64_t size_;               /// nodes under it, itself included
+    uint64_t left_;               /// of those under its left child
+} big_node_t;
+
+/**
+ * Size of the subtree under root, post-order with the children's sizes
+ * on a stack. Every node with more than grain nodes under it is added
+ * to big in post-order, with the size of its left subtree, so the size
+ * of each of its children is known too. Those are the only nodes
+ * printInOrder() has to look at one by one.
+ */
+template <typename N>
+uint64_t
+countSubtree(const N *root, uint64_t grain, vector<big_node_t>& big)
+{
+    vector<uint64_t> sizes;
+    PostOrderIter<N> it(root);
+    for (const N *t; (t = it.next()) != NULL; ) {
+        uint64_t right = 0;
+        uint64_t left = 0;
+        if (t->right_) {
+            right = sizes.back();
+            sizes.pop_back();
+        }
+        if (t->left_) {
+            left = sizes.back();
+            sizes.pop_back();
+        }
+
+        uint64_t size = 1 + left + right;
+        if (size > grain) {
+            big_node_t b = { size, left };
+            big.push_back(b);
+        }
+        sizes.push_back(size);
+    }
+    return (sizes.empty() ? 0 : sizes.back());
+}
+
+/**
+ * The top levels of the tree, walked until a level is wide enough to
+ * keep threads busy (threads * sizeTasksPerThread subtrees) or for
+ * sizeTopDepth levels. frontier is left holding that level, the number
+ * of levels above it is returned.
+ */
+template <typename N>
+unsigned int
+topLevels(const N *root, unsigned int threads, vector<const N *>& frontier)
+{
+    frontier.clear();
+    if (root)
+        frontier.push_back(root);
+
+    unsigned int d = 0;
+    for (; d < sizeTopDepth && !frontier.empty() &&
+         frontier.size() < threads * sizeTasksPerThread; ++d) {
+        vector<const N *> next;
+        for (size_t i = 0; i < frontier.size(); ++i) {
+            const N *t = frontier[i];
+            if (t->left_)
+                next.push_back(t->left_);
+            if (t->right_)
+                next.push_back(t->right_);
+        }
+        frontier.swap(next);
+    }
+    return d;
+}
+
+/**
+ * countSubtree() for the nodes above the frontier, what is below comes
+ * from counted and below in left to right order. Recursive, but never
+ * deeper than sizeTopDepth.
+ */
+template <typename N>
+uint64_t
+sumTop(const N *t, unsigned int levels, uint64_t grain,
+       const vector<uint64_t>& counted, vector<vector<big_node_t> >& below,
+       size_t& next, vector<big_node_t>& big)
+{
+    if (levels == 0) {
+        vector<big_node_t>& b = below[next];
+        big.insert(big.end(), b.begin(), b.end());
+        vector<big_node_t>().swap(b);
+        return counted[next++];
+    }
+
+    uint64_t left = 0;
+    uint64_t right = 0;
+    if (t->left_)
+        left = sumTop(t->left_, levels - 1, grain, counted, below, next, big);
+    if (t->right_)
+        right = sumTop(t->right_, levels - 1, grain, counted, below, next,
+                       big);
+
+    uint64_t size = 1 + left + right;
+    if (size > grain) {
+        big_node_t b = { size, left };
+        big.push_back(b);
+    }
+    return size;
+}
+
+/**
+ * countSubtree() of the whole tree, root is levels above frontier (see
+ * topLevels()). The frontier subtrees are counted in parallel, the top
+ * is summed up from them.
+ */
+template <typename N>
+uint64_t
+subtreeSizes(const N *root, unsigned int threads, uint64_t grain,
+             const vector<const N *>& frontier, unsigned int levels,
+             vector<big_node_t>& big)
+{
+    vector<uint64_t> counted(frontier.size());
+    vector<vector<big_node_t> > below(frontier.size());
+    atomic<size_t> next_task(0);
+    vector<thread> pool;
+    size_t workers = min((size_t)threads, frontier.size());
+    for (size_t w = 0; w < workers; ++w) {
+        pool.push_back(thread([&]() {
+            for (size_t i; (i = next_task++) < frontier.size(); )
+                counted[i] = countSubtree(frontier[i], grain, below[i]);
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+
+    size_t next = 0;
+    return sumTop(root, levels, grain, counted, below, next, big);
+}
+
+/**
+ * left subtree, root, right subtree. With the subtree sizes the
+ * in-order sequence is cut into entries: whole subtrees of at most
+ * grain nodes and the single nodes above them, a pointer and a count
+ * each. Consecutive entries are grouped into chunks of about grain
+ * nodes, and idle threads take the next chunk, so a lopsided tree keeps
+ * them all busy. A tree that is still narrower than that after the top
+ * sizeTopDepth levels (a chain, or close to one) has next to nothing to
+ * split, and is printed serially.
+ */
+template <typename N, typename F>
+void
+printInOrder(const N *root, unsigned int threads, OutputSink& sink,
+             F print)
+{
+    vector<const N *> frontier;
+    unsigned int levels = topLevels(root, threads, frontier);
+    if (frontier.size() < threads * sizeTasksPerThread) {
+        BufferedWriter out(sink);
+        InOrderIter<N> it(root);
+        for (const N *t; (t = it.next()) != NULL; )
+            print(out, t);
+        out.put('\n');
+        return;
+    }
+
+    vector<big_node_t> big;
+    uint64_t size = subtreeSizes(root, threads, inOrderGrain, frontier,
+                                 levels, big);
+
+    // right subtree, root, left subtree takes big from the back, and
+    // gives the entries last to first.
+    vector<const N *> nodes;
+    vector<uint64_t> counts;
+    nodes.reserve(2 * big.size() + 1);
+    counts.reserve(2 * big.size() + 1);
+    vector<pair<const N *, uint64_t> > stack;  /// node, its left size
+    size_t b = big.size();
+    const N *cur = root;
+    for (;;) {
+        while (cur && size > inOrderGrain) {
+            const big_node_t& e = big[--b];
+            stack.push_back(make_pair(cur, e.left_));
+            cur = cur->right_;
+            size = e.size_ - 1 - e.left_;
+        }
+
+        if (cur) {
+            nodes.push_back(cur);
+            counts.push_back(size);
+            cur = NULL;
+        } else if (!stack.empty()) {
+            nodes.push_back(stack.back().first);
+            counts.push_back(1);
+            cur = stack.back().first->left_;
+            size = stack.back().second;
+            stack.pop_back();
+        } else {
+            break;
+        }
+    }
+    vector<big_node_t>().swap(big);
+    reverse(nodes.begin(), nodes.end());
+    reverse(counts.begin(), counts.end());
+
+    vector<size_t> chunk_start;   /// first entry of every chunk
+    uint64_t in_chunk = inOrderGrain;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (in_chunk >= inOrderGrain) {
+            chunk_start.push_back(i);
+            in_chunk = 0;
+        }
+        in_chunk += counts[i];
+    }
+    chunk_start.push_back(nodes.size());
+
+    writeOrdered(chunk_start.size() - 1, threads, sink,
+                 [&](size_t c, string& s) {
+        StringSink ss;
+        {
+            BufferedWriter w(ss, chunkWriterSize);
+            for (size_t i = chunk_start[c]; i < chunk_start[c + 1]; ++i) {
+                if (counts[i] == 1) {
+                    print(w, nodes[i]);
+                    continue;
+                }
+                InOrderIter<N> it(nodes[i]);
+                for (const N *t; (t = it.next()) != NULL; )
+                    print(w, t);
+            }
+        }
+        s.swap(ss.str());
+    });
+
+    sink.write("\n", 1);
+}
+
+#endif
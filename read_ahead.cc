@@ -0,0 +1,473 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:read_ahead.cc
+ * Read ahead for decodeFile(), see read_ahead.h.
+ * URING: the calling thread submits one IORING_OP_READV per buffer and
+ * reaps completions while it waits for the block it wants, a short read
+ * is resubmitted for the rest. Nothing else runs, the kernel does the
+ * reading.
+ * PREAD: one thread reads the blocks in order, a block is handed over
+ * (and given back) under lock_.
+ */
+
+#include "read_ahead.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+/// block::state_
+const int blockIdle = 0;          /// PREAD: free for the reader thread
+const int blockBusy = 1;          /// being read
+const int blockReady = 2;
+const int blockFailed = 3;
+
+static int
+uringSetup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uringEnter(int ring, unsigned int submit, unsigned int wait,
+           unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring, submit, wait, flags,
+                        NULL, 0);
+}
+
+ReadAhead::ReadAhead(size_t block_size, unsigned int depth, ReadBackend want)
+    : blockSize_(block_size),
+      want_(want),
+      backend_(ReadBackend::PREAD),
+      blocks_(depth > 0 ? depth : 1),
+      err_(&cerr),
+      fd_(-1),
+      size_(0),
+      count_(0),
+      next_(0),
+      held_(false),
+      ring_(-1),
+      sqMap_(NULL),
+      sqMapLen_(0),
+      cqMap_(NULL),
+      cqMapLen_(0),
+      sqes_(NULL),
+      sqesLen_(0),
+      inflight_(0),
+      stop_(false)
+{
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        blocks_[i].data_ = NULL;
+        blocks_[i].state_ = blockIdle;
+    }
+}
+
+ReadAhead::~ReadAhead()
+{
+    close();
+    for (size_t i = 0; i < blocks_.size(); ++i)
+        free(blocks_[i].data_);
+}
+
+/**
+ * Open fname and get the first depth blocks going.
+ */
+int
+ReadAhead::open(const string& fname, ostream& err)
+{
+    close();
+    fname_ = fname;
+    err_ = &err;
+
+    fd_ = ::open(fname.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        err << fname << " : error in open " << strerror(errno) << endl;
+        return(-1);
+    }
+
+    struct stat sbuf;
+    if (::fstat(fd_, &sbuf) == -1) {
+        err << "fstat Error for fname : " << fname << " "
+            << strerror(errno) << endl;
+        close();
+        return(-1);
+    }
+    size_ = sbuf.st_size;
+    count_ = (size_ + blockSize_ - 1) / blockSize_;
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        blocks_[i].state_ = blockIdle;
+        // page aligned, the kernel copies out whole pages.
+        if (!blocks_[i].data_ &&
+            posix_memalign((void **)&blocks_[i].data_, 4096, blockSize_)) {
+            blocks_[i].data_ = NULL;
+            err << fname << " : out of memory for read ahead" << endl;
+            close();
+            return(-1);
+        }
+    }
+
+    backend_ = ReadBackend::PREAD;
+    if (want_ == ReadBackend::URING && setupUring() == 0)
+        backend_ = ReadBackend::URING;
+
+    if (backend_ == ReadBackend::URING) {
+        for (uint64_t s = 0; s < count_ && s < blocks_.size(); ++s)
+            start(s, s);
+    } else {
+        stop_ = false;
+        reader_ = thread(&ReadAhead::readerLoop, this);
+    }
+    return(0);
+}
+
+int
+ReadAhead::next(const char **buf, size_t *len)
+{
+    if (held_) {
+        // the caller is done with the block before, refill its buffer.
+        held_ = false;
+        uint64_t done = next_ - 1;
+        unsigned int b = done % blocks_.size();
+        if (backend_ == ReadBackend::URING) {
+            if (done + blocks_.size() < count_)
+                start(b, done + blocks_.size());
+        } else {
+            lock_guard<mutex> g(lock_);
+            blocks_[b].state_ = blockIdle;
+            changed_.notify_all();
+        }
+    }
+
+    if (next_ >= count_)
+        return(0);
+
+    unsigned int b = next_ % blocks_.size();
+    if (wait(b) < 0) {
+        *err_ << fname_ << " : read error " << strerror(errno) << endl;
+        return(-1);
+    }
+
+    *buf = blocks_[b].data_;
+    *len = blocks_[b].got_;
+    next_++;
+    held_ = true;
+    return(1);
+}
+
+/**
+ * Stop reading, reads still in the kernel are waited for before the
+ * buffers can be used again.
+ */
+void
+ReadAhead::close()
+{
+    if (reader_.joinable()) {
+        {
+            lock_guard<mutex> g(lock_);
+            stop_ = true;
+            changed_.notify_all();
+        }
+        reader_.join();
+    }
+
+    if (ring_ >= 0) {
+        while (inflight_ > 0) {
+            if (reapUring(true) < 0 && errno != EINTR)
+                break;
+        }
+        closeUring();
+    }
+
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+    count_ = 0;
+    next_ = 0;
+    held_ = false;
+}
+
+/**
+ * URING: read block seq of the file into buffer b.
+ */
+void
+ReadAhead::start(unsigned int b, uint64_t seq)
+{
+    block& k = blocks_[b];
+    uint64_t off = seq * blockSize_;
+    k.seq_ = seq;
+    k.want_ = (size_ - off < blockSize_ ? size_ - off : blockSize_);
+    k.got_ = 0;
+    k.state_ = blockBusy;
+    k.errno_ = 0;
+    if (submitUring(b) < 0) {
+        k.state_ = blockFailed;
+        k.errno_ = errno;
+    }
+}
+
+/**
+ * Until buffer b holds its block, 0 or -1 with errno set.
+ */
+int
+ReadAhead::wait(unsigned int b)
+{
+    block& k = blocks_[b];
+    if (backend_ == ReadBackend::URING) {
+        while (k.state_ == blockBusy) {
+            if (reapUring(true) < 0 && errno != EINTR)
+                return(-1);
+        }
+    } else {
+        unique_lock<mutex> g(lock_);
+        changed_.wait(g, [&]() {
+            return k.state_ == blockReady || k.state_ == blockFailed;
+        });
+    }
+
+    if (k.state_ == blockFailed) {
+        errno = k.errno_;
+        return(-1);
+    }
+    return(0);
+}
+
+int
+ReadAhead::setupUring()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ring = uringSetup(blocks_.size(), &p);
+    if (ring < 0)
+        return(-1);             /// ENOSYS, EPERM: use the thread.
+
+    ring_ = ring;
+    sqMapLen_ = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cqMapLen_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (cqMapLen_ > sqMapLen_)
+            sqMapLen_ = cqMapLen_;
+        cqMapLen_ = sqMapLen_;
+    }
+
+    sqMap_ = mmap(NULL, sqMapLen_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQ_RING);
+    if (sqMap_ == MAP_FAILED) {
+        sqMap_ = NULL;
+        closeUring();
+        return(-1);
+    }
+    cqMap_ = sqMap_;
+    if (!single) {
+        cqMap_ = mmap(NULL, cqMapLen_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_CQ_RING);
+        if (cqMap_ == MAP_FAILED) {
+            cqMap_ = NULL;
+            closeUring();
+            return(-1);
+        }
+    }
+    sqesLen_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(NULL, sqesLen_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = NULL;
+        closeUring();
+        return(-1);
+    }
+
+    char *sq = (char *)sqMap_;
+    char *cq = (char *)cqMap_;
+    sqHead_ = (unsigned int *)(sq + p.sq_off.head);
+    sqTail_ = (unsigned int *)(sq + p.sq_off.tail);
+    sqMask_ = (unsigned int *)(sq + p.sq_off.ring_mask);
+    sqArray_ = (unsigned int *)(sq + p.sq_off.array);
+    cqHead_ = (unsigned int *)(cq + p.cq_off.head);
+    cqTail_ = (unsigned int *)(cq + p.cq_off.tail);
+    cqMask_ = (unsigned int *)(cq + p.cq_off.ring_mask);
+    cqes_ = cq + p.cq_off.cqes;
+    inflight_ = 0;
+    return(0);
+}
+
+void
+ReadAhead::closeUring()
+{
+    if (sqes_)
+        munmap(sqes_, sqesLen_);
+    if (cqMap_ && cqMap_ != sqMap_)
+        munmap(cqMap_, cqMapLen_);
+    if (sqMap_)
+        munmap(sqMap_, sqMapLen_);
+    sqes_ = NULL;
+    cqMap_ = NULL;
+    sqMap_ = NULL;
+    ::close(ring_);
+    ring_ = -1;
+    inflight_ = 0;
+}
+
+/**
+ * Queue a read of what buffer b is still missing. At most depth reads
+ * are out at a time so the submission queue never fills up.
+ */
+int
+ReadAhead::submitUring(unsigned int b)
+{
+    block& k = blocks_[b];
+    k.iov_.iov_base = k.data_ + k.got_;
+    k.iov_.iov_len = k.want_ - k.got_;
+
+    unsigned int tail = *sqTail_;   /// we are the only producer.
+    unsigned int idx = tail & *sqMask_;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes_ + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd_;
+    sqe->off = k.seq_ * blockSize_ + k.got_;
+    sqe->addr = (uint64_t)(uintptr_t)&k.iov_;
+    sqe->len = 1;
+    sqe->user_data = b;
+    sqArray_[idx] = idx;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = uringEnter(ring_, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        if (ret >= 0)
+            errno = EIO;
+        return(-1);
+    }
+    inflight_++;
+    return(0);
+}
+
+/**
+ * Account every completion there is, with wait_one for at least one.
+ */
+int
+ReadAhead::reapUring(bool wait_one)
+{
+    unsigned int head = *cqHead_;
+    if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        if (!wait_one)
+            return(0);
+        if (uringEnter(ring_, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            return(-1);
+    }
+
+    unsigned int tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe =
+            (const struct io_uring_cqe *)cqes_ + (head & *cqMask_);
+        unsigned int b = cqe->user_data;
+        int res = cqe->res;
+        inflight_--;
+
+        block& k = blocks_[b];
+        if (res == -EINTR || res == -EAGAIN) {
+            res = 0;
+        } else if (res < 0) {
+            k.state_ = blockFailed;
+            k.errno_ = -res;
+            continue;
+        } else if (res == 0) {
+            k.want_ = k.got_;     /// the file got shorter.
+        }
+
+        k.got_ += res;
+        if (k.got_ == k.want_) {
+            k.state_ = blockReady;
+        } else if (submitUring(b) < 0) {
+            k.state_ = blockFailed;
+            k.errno_ = errno;
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return(0);
+}
+
+/**
+ * PREAD: fill the buffers in file order, each one once the caller gave
+ * it back.
+ */
+void
+ReadAhead::readerLoop()
+{
+    for (uint64_t seq = 0; seq < count_; ++seq) {
+        block& k = blocks_[seq % blocks_.size()];
+        {
+            unique_lock<mutex> g(lock_);
+            changed_.wait(g, [&]() {
+                return stop_ || k.state_ == blockIdle;
+            });
+            if (stop_)
+                return;
+            uint64_t off = seq * blockSize_;
+            k.seq_ = seq;
+            k.want_ = (size_ - off < blockSize_ ? size_ - off : blockSize_);
+            k.got_ = 0;
+            k.errno_ = 0;
+            k.state_ = blockBusy;
+        }
+
+        while (k.got_ < k.want_) {
+            ssize_t n = pread(fd_, k.data_ + k.got_, k.want_ - k.got_,
+                              k.seq_ * blockSize_ + k.got_);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                k.errno_ = errno;
+                break;
+            }
+            if (n == 0) {
+                k.want_ = k.got_;  /// the file got shorter.
+                break;
+            }
+            k.got_ += n;
+        }
+
+        lock_guard<mutex> g(lock_);
+        k.state_ = (k.errno_ != 0 ? blockFailed : blockReady);
+        changed_.notify_all();
+        if (k.errno_ != 0)
+            return;
+    }
+}
@@ -0,0 +1,111 @@
+// -*- C++ -*-
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+using namespace std;
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+enum class ReadBackend : std::int8_t
+{
+    PREAD = 0,        /// a reader thread doing pread(2)
+    URING = 1         /// io_uring, no thread, falls back to PREAD
+};
+
+/**
+ * Sequential reader that keeps up to depth blocks of the file in flight
+ * while the caller works on the one handed out last. The blocks form a
+ * ring: block n of the file always lands in buffer n % depth, and that
+ * buffer is read again (block n + depth) only once the caller asked for
+ * the block after n.
+ *   ReadAhead ra;
+ *   ra.open(fname);
+ *   while ((ret = ra.next(&buf, &len)) > 0) bt.feed(buf, len);
+ * io_uring is set up with raw syscalls (no liburing). Where it is not
+ * there (old kernel, seccomp) the reads go to a thread instead.
+ */
+class ReadAhead
+{
+public:
+    explicit ReadAhead(size_t block_size = 1 << 20, unsigned int depth = 4,
+                       ReadBackend want = ReadBackend::URING);
+    virtual ~ReadAhead();
+
+    int open(const string& fname, ostream& err = cerr);
+    /// The next block in file order, valid until the next call.
+    /// Returns 1, 0 at the end of the file or -1 on a read error.
+    int next(const char **buf, size_t *len);
+    void close();
+
+    ReadBackend backend() const { return backend_; }
+    uint64_t size() const { return size_; }
+
+private:
+    ReadAhead(const ReadAhead&);            /// no copies.
+    ReadAhead& operator=(const ReadAhead&);
+
+    struct block
+    {
+        char *data_;
+        uint64_t seq_;            /// which block of the file
+        size_t want_;
+        size_t got_;
+        int state_;               /// see read_ahead.cc
+        int errno_;
+        struct iovec iov_;        /// what is left to read, URING
+    };
+
+    void start(unsigned int b, uint64_t seq);
+    int wait(unsigned int b);
+    int setupUring();
+    void closeUring();
+    int submitUring(unsigned int b);
+    int reapUring(bool wait_one);
+    void readerLoop();            /// PREAD thread
+
+    size_t blockSize_;
+    ReadBackend want_;
+    ReadBackend backend_;
+    vector<block> blocks_;
+    string fname_;
+    ostream *err_;
+    int fd_;
+    uint64_t size_;
+    uint64_t count_;              /// blocks in the file
+    uint64_t next_;               /// handed out next
+    bool held_;                   /// the caller has block next_ - 1
+
+    // URING
+    int ring_;
+    void *sqMap_;
+    size_t sqMapLen_;
+    void *cqMap_;
+    size_t cqMapLen_;
+    void *sqes_;
+    size_t sqesLen_;
+    unsigned int *sqHead_;
+    unsigned int *sqTail_;
+    unsigned int *sqMask_;
+    unsigned int *sqArray_;
+    unsigned int *cqHead_;
+    unsigned int *cqTail_;
+    unsigned int *cqMask_;
+    void *cqes_;
+    unsigned int inflight_;
+
+    // PREAD
+    thread reader_;
+    mutex lock_;
+    condition_variable changed_;
+    bool stop_;
+};
+
+#endif
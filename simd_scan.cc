@@ -0,0 +1,359 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:simd_scan.cc
+ * SIMD line tokenizer behind BuildTree::parseSpan(), see simd_scan.h.
+ * Vector loads may run past the end of a line (but never over a page
+ * boundary), the extra bytes are masked off, this is what lets a 20
+ * byte line still be classified with one load.
+ */
+
+#include "simd_scan.h"
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SCAN_X86 1
+#endif
+
+using namespace std;
+
+/// The page bounded over-reads below are deliberate, keep ASan off them.
+#define SCAN_OVERREAD __attribute__((no_sanitize_address))
+
+const uintptr_t pageSize = 4096;
+const size_t headBytes = 64;     /// bits in the classify masks
+
+typedef void (*classifyFn)(const char *p, size_t n, uint64_t *spaces,
+                           uint64_t *digits);
+typedef const char *(*findNewlineFn)(const char *p, const char *end);
+
+/// A width byte load at p stays inside p's page.
+static inline bool
+pageSafe(const char *p, size_t width)
+{
+    return (((uintptr_t)p & (pageSize - 1)) <= pageSize - width);
+}
+
+static inline uint64_t
+lowBits(size_t n)
+{
+    return (n >= 64 ? ~0ULL : (1ULL << n) - 1);
+}
+
+/**
+ * Bit i of *spaces / *digits is set when p[i] is ' ' / '0'..'9',
+ * for i < n <= 64.
+ */
+static void
+classifyScalar(const char *p, size_t n, uint64_t *spaces, uint64_t *digits)
+{
+    uint64_t s = 0, d = 0;
+    for (size_t i = 0; i < n; ++i) {
+        s |= (uint64_t)(p[i] == ' ') << i;
+        d |= (uint64_t)(p[i] >= '0' && p[i] <= '9') << i;
+    }
+    *spaces = s;
+    *digits = d;
+}
+
+static const char *
+findNewlineScalar(const char *p, const char *end)
+{
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return (nl ? nl : end);
+}
+
+#ifdef SIMD_SCAN_X86
+
+/**
+ * PCMPESTRM does both classes in one instruction each, "09" as a range
+ * and " " as a set.
+ */
+__attribute__((target("sse4.2")))
+SCAN_OVERREAD
+static void
+classifySse42(const char *p, size_t n, uint64_t *spaces, uint64_t *digits)
+{
+    const __m128i space_set = _mm_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i digit_range = _mm_setr_epi8('0', '9', 0, 0, 0, 0, 0, 0,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+    uint64_t s = 0, d = 0;
+    size_t i = 0;
+    for (; i < n; i += 16) {
+        if (i + 16 > n && !pageSafe(p + i, 16)) {
+            uint64_t ts, td;
+            classifyScalar(p + i, n - i, &ts, &td);
+            s |= ts << i;
+            d |= td << i;
+            break;
+        }
+
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i ms = _mm_cmpestrm(space_set, 1, v, 16,
+                                  _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                                  _SIDD_BIT_MASK);
+        __m128i md = _mm_cmpestrm(digit_range, 2, v, 16,
+                                  _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                  _SIDD_BIT_MASK);
+        s |= (uint64_t)(uint16_t)_mm_cvtsi128_si32(ms) << i;
+        d |= (uint64_t)(uint16_t)_mm_cvtsi128_si32(md) << i;
+    }
+    *spaces = s & lowBits(n);
+    *digits = d & lowBits(n);
+}
+
+__attribute__((target("avx2")))
+SCAN_OVERREAD
+static void
+classifyAvx2(const char *p, size_t n, uint64_t *spaces, uint64_t *digits)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    uint64_t s = 0, d = 0;
+    size_t i = 0;
+    for (; i < n; i += 32) {
+        if (i + 32 > n && !pageSafe(p + i, 32)) {
+            uint64_t ts, td;
+            classifyScalar(p + i, n - i, &ts, &td);
+            s |= ts << i;
+            d |= td << i;
+            break;
+        }
+
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i ms = _mm256_cmpeq_epi8(v, space);
+        // c - '0' <= 9 unsigned.
+        __m256i t = _mm256_sub_epi8(v, zero);
+        __m256i md = _mm256_cmpeq_epi8(_mm256_min_epu8(t, nine), t);
+        s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ms) << i;
+        d |= (uint64_t)(uint32_t)_mm256_movemask_epi8(md) << i;
+    }
+    *spaces = s & lowBits(n);
+    *digits = d & lowBits(n);
+}
+
+__attribute__((target("sse4.2")))
+SCAN_OVERREAD
+static const char *
+findNewlineSse42(const char *p, const char *end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; p < end; p += 16) {
+        if (end - p < 16 && !pageSafe(p, 16))
+            return findNewlineScalar(p, end);
+
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (m) {
+            const char *hit = p + __builtin_ctz(m);
+            return (hit < end ? hit : end);
+        }
+    }
+    return end;
+}
+
+__attribute__((target("avx2")))
+SCAN_OVERREAD
+static const char *
+findNewlineAvx2(const char *p, const char *end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; p < end; p += 32) {
+        if (end - p < 32 && !pageSafe(p, 32))
+            return findNewlineSse42(p, end);
+
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (m) {
+            const char *hit = p + __builtin_ctz(m);
+            return (hit < end ? hit : end);
+        }
+    }
+    return end;
+}
+
+#endif // SIMD_SCAN_X86
+
+static SimdLevel
+detectLevel()
+{
+#ifdef SIMD_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SimdLevel::SSE42;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+static SimdLevel cpuLevel = detectLevel();
+static SimdLevel curLevel = cpuLevel;
+static classifyFn classify = classifyScalar;
+static findNewlineFn newline = findNewlineScalar;
+
+static void
+pickLevel(SimdLevel level)
+{
+    curLevel = level;
+    classify = classifyScalar;
+    newline = findNewlineScalar;
+#ifdef SIMD_SCAN_X86
+    if (level == SimdLevel::AVX2) {
+        classify = classifyAvx2;
+        newline = findNewlineAvx2;
+    } else if (level == SimdLevel::SSE42) {
+        classify = classifySse42;
+        newline = findNewlineSse42;
+    }
+#endif
+}
+
+/// Dispatch is set up before main(), setSimdLevel() is not thread safe.
+static struct simd_init
+{
+    simd_init() { pickLevel(cpuLevel); }
+} simdInit;
+
+SimdLevel
+simdLevel()
+{
+    return curLevel;
+}
+
+void
+setSimdLevel(SimdLevel level)
+{
+    pickLevel(level < cpuLevel ? level : cpuLevel);
+}
+
+const char *
+simdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::SSE42: return "sse4.2";
+    default: return "scalar";
+    }
+}
+
+const char *
+findNewline(const char *p, const char *end)
+{
+    return newline(p, end);
+}
+
+/**
+ * sscanf("%lld") on one token: leading white space and a sign are fine,
+ * anything after the digits is ignored.
+ */
+static bool
+scanInt(const char *p, const char *end, int64_t *val)
+{
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+
+    uint64_t v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        v = v * 10 + (*p - '0');
+    }
+
+    *val = (int64_t)(neg ? 0 - v : v);
+    return true;
+}
+
+void
+scanHead(const char *line, size_t len, line_head_t *h)
+{
+    const char *end = line + len;
+    size_t w = (len < headBytes ? len : headBytes);
+    uint64_t spaces, digits;
+    classify(line, w, &spaces, &digits);
+
+    h->count_ = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t tend;
+        if (pos < w) {
+            // skip the run of spaces, then the token ends at the next one.
+            uint64_t non_space = ~spaces & lowBits(w) & ~lowBits(pos);
+            if (!non_space) {
+                pos = w;
+                continue;
+            }
+            pos = __builtin_ctzll(non_space);
+            uint64_t next_space = spaces & ~lowBits(pos);
+            if (next_space) {
+                tend = __builtin_ctzll(next_space);
+            } else if (w == len) {
+                tend = len;
+            } else {
+                const char *sp = (const char *)memchr(line + w, ' ', len - w);
+                tend = (sp ? sp : end) - line;
+            }
+        } else {
+            if (line[pos] == ' ') {
+                pos++;
+                continue;
+            }
+            const char *sp = (const char *)memchr(line + pos, ' ', len - pos);
+            tend = (sp ? sp : end) - line;
+        }
+
+        if (h->count_ == lineHeadMax)
+            break;                // fourth token, description from here.
+
+        // all digits and short enough not to overflow: no checks needed.
+        int64_t val = 0;
+        size_t tlen = tend - pos;
+        if (tend <= w && tlen <= 9 &&
+            ((digits >> pos) & lowBits(tlen)) == lowBits(tlen)) {
+            for (const char *c = line + pos; c < line + tend; ++c)
+                val = val * 10 + (*c - '0');
+        } else if (!scanInt(line + pos, line + tend, &val)) {
+            break;
+        }
+
+        h->vals_[h->count_] = val;
+        h->toks_[h->count_] = line + pos;
+        h->count_++;
+        pos = tend + 1;
+    }
+
+    h->rest_ = (pos < len ? line + pos : end);
+}
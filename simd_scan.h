@@ -0,0 +1,55 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+/**
+ * Vectorized helpers for the "id [left [right]] [description]" lines.
+ * The instruction set is picked once at run time (AVX2, SSE4.2 or plain
+ * C++), nothing needs -mavx2 at build time.
+ */
+enum class SimdLevel : std::int8_t
+{
+    SCALAR = 0,
+    SSE42 = 1,
+    AVX2 = 2
+};
+
+/// What this CPU supports, or what setSimdLevel() lowered it to.
+SimdLevel simdLevel();
+/// Use at most level, e.g. SCALAR to compare against the plain code.
+void setSimdLevel(SimdLevel level);
+const char *simdLevelName(SimdLevel level);
+
+/// First '\n' in [p, end) or end, same as memchr().
+const char *findNewline(const char *p, const char *end);
+
+const unsigned int lineHeadMax = 3;   /// id, left, right
+
+/**
+ * The leading numeric tokens of a line. Tokens are split on ' ' and
+ * parsed the way sscanf("%lld") would, so "+3x" is 3 and "x3" is not a
+ * number. Scanning stops at the first token that is not a number or
+ * after lineHeadMax of them, rest_ is where the next token starts (the
+ * description, a fourth number included) or the end of the line.
+ */
+typedef struct line_head
+{
+    unsigned int count_;                  /// numeric tokens found
+    int64_t vals_[lineHeadMax];           /// 64 bit, narrower ids wrap
+    const char *toks_[lineHeadMax];       /// where each one starts
+    const char *rest_;
+} line_head_t;
+
+/**
+ * Fills h for line[0, len). Space and digit positions of the first 64
+ * bytes come from one vector pass, a token made of up to 9 digits is
+ * then converted without looking at it byte by byte for validation.
+ */
+void scanHead(const char *line, size_t len, line_head_t *h);
+
+#endif
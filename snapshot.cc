@@ -0,0 +1,306 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:snapshot.cc
+ * Binary structure-of-arrays snapshot of a decoded tree. Written once
+ * after decodeFile(), loaded with mmap() so a service can skip the text
+ * parse and the id map entirely.
+ */
+
+#include "snapshot.h"
+#include "build_tree.h"
+#include <string.h>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const char snapshotMagic[8] = { 'B', 'T', 'S', 'N', 'A', 'P', 0, 0 };
+
+static uint64_t
+align8(uint64_t off)
+{
+    return (off + 7) & ~(uint64_t)7;
+}
+
+static void
+writePad(fstream& out, uint64_t& pos, uint64_t to)
+{
+    static const char zeros[8] = { 0 };
+    out.write(zeros, to - pos);
+    pos = to;
+}
+
+/**
+ * Number the nodes in BFS order, a node's children get the next free
+ * numbers as it is dequeued so the order vector doubles as the queue.
+ */
+int
+writeSnapshot(const string& fname, const node_t *root)
+{
+    if (!root) {
+        cerr << "snapshot : no tree to write" << endl;
+        return(-1);
+    }
+
+    vector<const node_t *> order;
+    vector<uint32_t> left, right;
+    vector<uint64_t> descr_off;
+    order.push_back(root);
+    uint64_t blob = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const node_t *t = order[i];
+        left.push_back(t->left_ ? (uint32_t)order.size() : snapshotNone);
+        if (t->left_)
+            order.push_back(t->left_);
+        right.push_back(t->right_ ? (uint32_t)order.size() : snapshotNone);
+        if (t->right_)
+            order.push_back(t->right_);
+        descr_off.push_back(blob);
+        blob += t->dlen_;
+        if (order.size() >= snapshotNone) {
+            cerr << "snapshot : too many nodes" << endl;
+            return(-1);
+        }
+    }
+    descr_off.push_back(blob);
+
+    uint64_t count = order.size();
+    snap_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic_, snapshotMagic, sizeof(hdr.magic_));
+    hdr.version_ = snapshotVersion;
+    hdr.headerSize_ = sizeof(hdr);
+    hdr.count_ = count;
+    hdr.blobSize_ = blob;
+    hdr.idsOff_ = align8(sizeof(hdr));
+    hdr.leftOff_ = align8(hdr.idsOff_ + count * sizeof(int32_t));
+    hdr.rightOff_ = align8(hdr.leftOff_ + count * sizeof(uint32_t));
+    hdr.descrOff_ = align8(hdr.rightOff_ + count * sizeof(uint32_t));
+    hdr.blobOff_ = hdr.descrOff_ + (count + 1) * sizeof(uint64_t);
+    hdr.fileSize_ = hdr.blobOff_ + blob;
+
+    fstream out(fname.c_str(), fstream::out | fstream::trunc |
+                fstream::binary);
+    if (!out) {
+        cerr << fname << " : error in open " << strerror(errno) << endl;
+        return(-1);
+    }
+
+    uint64_t pos = sizeof(hdr);
+    out.write((const char *)&hdr, sizeof(hdr));
+    writePad(out, pos, hdr.idsOff_);
+    for (size_t i = 0; i < count; ++i) {
+        int32_t id = order[i]->id_;
+        out.write((const char *)&id, sizeof(id));
+    }
+    pos += count * sizeof(int32_t);
+    writePad(out, pos, hdr.leftOff_);
+    out.write((const char *)&left[0], count * sizeof(uint32_t));
+    pos += count * sizeof(uint32_t);
+    writePad(out, pos, hdr.rightOff_);
+    out.write((const char *)&right[0], count * sizeof(uint32_t));
+    pos += count * sizeof(uint32_t);
+    writePad(out, pos, hdr.descrOff_);
+    out.write((const char *)&descr_off[0], (count + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < count; ++i) {
+        out.write(order[i]->descr_, order[i]->dlen_);
+    }
+
+    out.close();
+    if (!out) {
+        cerr << fname << " : error writing snapshot" << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+TreeSnapshot::TreeSnapshot()
+    : hdr_(NULL),
+      ids_(NULL),
+      left_(NULL),
+      right_(NULL),
+      descrOff_(NULL),
+      blob_(NULL)
+{
+}
+
+TreeSnapshot::~TreeSnapshot()
+{
+    close();
+}
+
+/**
+ * Map and check the header, then the arrays: nothing in the file is
+ * used as an index or an offset before it was checked, see valid().
+ */
+int
+TreeSnapshot::open(const string& fname)
+{
+    close();
+    if (file_.open(fname) < 0)
+        return(-1);
+
+    const snap_header_t *hdr = (const snap_header_t *)file_.begin();
+    if (file_.size() < sizeof(snap_header_t) ||
+        memcmp(hdr->magic_, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        cerr << fname << " : not a tree snapshot" << endl;
+        file_.close();
+        return(-1);
+    }
+
+    if (hdr->version_ != snapshotVersion ||
+        hdr->headerSize_ != sizeof(snap_header_t)) {
+        cerr << fname << " : unsupported snapshot version "
+             << hdr->version_ << endl;
+        file_.close();
+        return(-1);
+    }
+
+    uint64_t count = hdr->count_;
+    uint64_t fsize = hdr->fileSize_;
+    if (fsize != file_.size() || count == 0 ||
+        count >= snapshotNone ||
+        hdr->idsOff_ < sizeof(snap_header_t) || hdr->idsOff_ > fsize ||
+        hdr->leftOff_ > fsize || hdr->rightOff_ > fsize ||
+        hdr->descrOff_ > fsize || hdr->blobOff_ > fsize ||
+        hdr->blobSize_ > fsize ||
+        hdr->leftOff_ < hdr->idsOff_ + count * sizeof(int32_t) ||
+        hdr->rightOff_ < hdr->leftOff_ + count * sizeof(uint32_t) ||
+        hdr->descrOff_ < hdr->rightOff_ + count * sizeof(uint32_t) ||
+        hdr->blobOff_ < hdr->descrOff_ + (count + 1) * sizeof(uint64_t) ||
+        hdr->blobOff_ + hdr->blobSize_ != hdr->fileSize_) {
+        cerr << fname << " : truncated or corrupt snapshot" << endl;
+        file_.close();
+        return(-1);
+    }
+
+    const char *base = file_.begin();
+    hdr_ = hdr;
+    ids_ = (const int32_t *)(base + hdr->idsOff_);
+    left_ = (const uint32_t *)(base + hdr->leftOff_);
+    right_ = (const uint32_t *)(base + hdr->rightOff_);
+    descrOff_ = (const uint64_t *)(base + hdr->descrOff_);
+    blob_ = base + hdr->blobOff_;
+    if (!valid()) {
+        cerr << fname << " : corrupt snapshot, bad child index or "
+             << "description offset" << endl;
+        close();
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ * writeSnapshot() numbers the nodes in BFS order, so walking them in
+ * order the children met are exactly 1, 2, 3 .. count - 1. That keeps
+ * every child index in range and the links a tree (no cycles, no node
+ * twice) for printDFS(). Description offsets go up from 0 to at most
+ * the blob size.
+ */
+bool
+TreeSnapshot::valid() const
+{
+    uint64_t count = hdr_->count_;
+    uint64_t next = 1;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (left_[i] != snapshotNone) {
+            if (left_[i] != next)
+                return false;
+            next++;
+        }
+        if (right_[i] != snapshotNone) {
+            if (right_[i] != next)
+                return false;
+            next++;
+        }
+    }
+    if (next != count)
+        return false;
+
+    if (descrOff_[0] != 0)
+        return false;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (descrOff_[i + 1] < descrOff_[i])
+            return false;
+    }
+    return (descrOff_[count] <= hdr_->blobSize_);
+}
+
+void
+TreeSnapshot::close()
+{
+    file_.close();
+    hdr_ = NULL;
+    ids_ = NULL;
+    left_ = right_ = NULL;
+    descrOff_ = NULL;
+    blob_ = NULL;
+}
+
+/**
+ * Nodes are stored in BFS order already.
+ */
+void
+TreeSnapshot::printBFS(OutputSink& sink) const
+{
+    if (!hdr_)
+        return;
+
+    BufferedWriter out(sink);
+    for (uint64_t i = 0; i < hdr_->count_; ++i) {
+        out.append(descr(i), descrLen(i));
+        out.put(' ');
+    }
+    out.put('\n');
+}
+
+/**
+ * In-order with an explicit stack of indices.
+ */
+void
+TreeSnapshot::printDFS(OutputSink& sink) const
+{
+    if (!hdr_)
+        return;
+
+    BufferedWriter out(sink);
+    vector<uint32_t> stack;
+    uint32_t cur = 0;
+    while (cur != snapshotNone || !stack.empty()) {
+        while (cur != snapshotNone) {
+            stack.push_back(cur);
+            cur = left_[cur];
+        }
+        cur = stack.back();
+        stack.pop_back();
+        out.append(descr(cur), descrLen(cur));
+        out.put(' ');
+        cur = right_[cur];
+    }
+    out.put('\n');
+}
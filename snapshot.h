@@ -0,0 +1,89 @@
+// -*- C++ -*-
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include "mapped_file.h"
+#include "out_writer.h"
+using namespace std;
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+struct node;
+
+const uint32_t snapshotVersion = 1;
+const uint32_t snapshotNone = 0xffffffff;   /// no child
+
+/**
+ * On disk layout, all offsets are in bytes from the start of the file
+ * and 8 byte aligned. Nodes are numbered in BFS order so the root is 0.
+ *   int32_t  ids[count]
+ *   uint32_t left[count], right[count]    (snapshotNone if absent)
+ *   uint64_t descrOff[count + 1]          (into blob)
+ *   char     blob[blobSize]
+ * Integers are in host byte order, loading on another endianness fails
+ * the magic check.
+ */
+typedef struct snap_header
+{
+    char magic_[8];               /// "BTSNAP" + 2 NUL
+    uint32_t version_;
+    uint32_t headerSize_;         /// sizeof(snap_header) when written
+    uint64_t count_;
+    uint64_t blobSize_;
+    uint64_t idsOff_;
+    uint64_t leftOff_;
+    uint64_t rightOff_;
+    uint64_t descrOff_;
+    uint64_t blobOff_;
+    uint64_t fileSize_;
+} snap_header_t;
+
+/// Write the tree under root, returns 0 or -1.
+int writeSnapshot(const string& fname, const struct node *root);
+
+/**
+ * A snapshot mapped read only, nothing is rebuilt on load, traversals run
+ * straight off the mapped arrays.
+ */
+class TreeSnapshot
+{
+public:
+    TreeSnapshot();
+    virtual ~TreeSnapshot();
+
+    int open(const string& fname);
+    void close();
+    bool isOpen() const { return hdr_ != NULL; }
+
+    uint64_t size() const { return hdr_ ? hdr_->count_ : 0; }
+    int32_t id(uint32_t i) const { return ids_[i]; }
+    uint32_t left(uint32_t i) const { return left_[i]; }
+    uint32_t right(uint32_t i) const { return right_[i]; }
+    const char *descr(uint32_t i) const { return blob_ + descrOff_[i]; }
+    size_t descrLen(uint32_t i) const
+    {
+        return descrOff_[i + 1] - descrOff_[i];
+    }
+
+    void printBFS(OutputSink& sink) const;
+    void printDFS(OutputSink& sink) const;
+
+private:
+    TreeSnapshot(const TreeSnapshot&);      /// no copies.
+    TreeSnapshot& operator=(const TreeSnapshot&);
+
+    bool valid() const;
+
+    MappedFile file_;
+    const snap_header_t *hdr_;
+    const int32_t *ids_;
+    const uint32_t *left_;
+    const uint32_t *right_;
+    const uint64_t *descrOff_;
+    const char *blob_;
+};
+
+#endif
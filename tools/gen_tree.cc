@@ -0,0 +1,244 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:gen_tree.cc
+ * Writes synthetic encoded trees ("id left right description" lines) for
+ * benchmarking decode_tree. Lines are produced on the fly so 1e8 nodes
+ * do not need the tree in memory (shuffled only keeps the line order).
+ * Shapes:
+ *   balanced   - complete tree, heap numbered, parents before children
+ *   leftchain  - spine down the left, a leaf on every right
+ *   rightchain - spine down the right, a leaf on every left
+ *   shuffled   - balanced, root line first then random line order
+ *                (like test_jumblenodes)
+ *   dupforest  - balanced with ids drawn from a small pool, decode with
+ *                -d (like test_cycle)
+ *   incomplete - random shape with single child nodes, decode with -i
+ *                (like test_completeonly)
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+
+using namespace std;
+
+enum class Shape : std::int8_t
+{
+    BALANCED = 0,
+    LEFT_CHAIN = 1,
+    RIGHT_CHAIN = 2,
+    SHUFFLED = 3,
+    DUP_FOREST = 4,
+    INCOMPLETE = 5
+};
+
+const long long maxNodes = 100LL * 1000 * 1000;
+const int dupPool = 1000;         /// distinct ids in a dupforest
+
+static bool
+parseShape(const string& s, Shape *shape)
+{
+    if (s == "balanced") *shape = Shape::BALANCED;
+    else if (s == "leftchain") *shape = Shape::LEFT_CHAIN;
+    else if (s == "rightchain") *shape = Shape::RIGHT_CHAIN;
+    else if (s == "shuffled") *shape = Shape::SHUFFLED;
+    else if (s == "dupforest") *shape = Shape::DUP_FOREST;
+    else if (s == "incomplete") *shape = Shape::INCOMPLETE;
+    else return false;
+    return true;
+}
+
+/**
+ * One line of a heap numbered complete tree with n nodes (n odd so every
+ * inner node has both children).
+ */
+static void
+balancedLine(FILE *out, long long i, long long n)
+{
+    if (2 * i + 1 <= n)
+        fprintf(out, "%lld %lld %lld node-%lld\n", i, 2 * i, 2 * i + 1, i);
+    else
+        fprintf(out, "%lld node-%lld\n", i, i);
+}
+
+/**
+ * Chains: spine ids 1..k, leaves k+1..n hang off the other side.
+ */
+static void
+writeChain(FILE *out, long long n, bool left)
+{
+    long long spine = (n + 1) / 2;
+    for (long long i = 1; i <= spine; ++i) {
+        if (i == spine) {
+            fprintf(out, "%lld spine-%lld\n", i, i);
+            break;
+        }
+        long long leaf = spine + i;
+        if (left)
+            fprintf(out, "%lld %lld %lld spine-%lld\n", i, i + 1, leaf, i);
+        else
+            fprintf(out, "%lld %lld %lld spine-%lld\n", i, leaf, i + 1, i);
+        fprintf(out, "%lld leaf-%lld\n", leaf, leaf);
+    }
+}
+
+/**
+ * Root keeps the unique id 0, everything else is 1..dupPool. BFS order
+ * makes every line fill the oldest waiting reference of its id, which
+ * is exactly the node it was written for.
+ */
+static void
+writeDupForest(FILE *out, long long n)
+{
+    for (long long i = 1; i <= n; ++i) {
+        long long id = (i == 1 ? 0 : 1 + (i % dupPool));
+        if (2 * i + 1 <= n)
+            fprintf(out, "%lld %lld %lld dup-%lld\n", id,
+                    1 + ((2 * i) % dupPool), 1 + ((2 * i + 1) % dupPool), i);
+        else
+            fprintf(out, "%lld dup-%lld\n", id, i);
+    }
+}
+
+/**
+ * BFS numbered random tree, nodes get 0, 1 or 2 children. A node never
+ * ends the tree early, the last open node always gets a child.
+ */
+static void
+writeIncomplete(FILE *out, long long n, mt19937_64& rng)
+{
+    long long next = 2;
+    for (long long i = 1; i <= n; ++i) {
+        int kids = rng() % 3;
+        if (i == next - 1 && kids == 0)
+            kids = 1;
+        if (next + kids - 1 > n)
+            kids = n - next + 1;
+
+        if (kids == 0)
+            fprintf(out, "%lld inc-%lld\n", i, i);
+        else if (kids == 1)
+            fprintf(out, "%lld %lld inc-%lld\n", i, next, i);
+        else
+            fprintf(out, "%lld %lld %lld inc-%lld\n", i, next, next + 1, i);
+        next += kids;
+    }
+}
+
+static void
+usage(const char *prog)
+{
+    cerr << "usage: " << prog << " -s <shape> [-n <nodes>] [-r <seed>]"
+         << " [-o <file>]" << endl
+         << "  shapes: balanced leftchain rightchain shuffled dupforest"
+         << " incomplete" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Shape shape = Shape::BALANCED;
+    bool got_shape = false;
+    long long n = 1000000;
+    unsigned long seed = 1;
+    string out_name("");
+    int c;
+    while ((c = getopt(argc, argv, "hs:n:r:o:")) != -1)
+    switch (c) {
+    case 's':
+        got_shape = parseShape(optarg, &shape);
+        break;
+    case 'n': n = atoll(optarg); break;
+    case 'r': seed = strtoul(optarg, NULL, 10); break;
+    case 'o': out_name = optarg; break;
+    case '?':
+    case 'h':
+    default:
+        usage(argv[0]);
+        return(-1);
+    }
+
+    if (!got_shape || n < 1 || n > maxNodes) {
+        usage(argv[0]);
+        return(-1);
+    }
+
+    FILE *out = stdout;
+    if (out_name.length() != 0) {
+        out = fopen(out_name.c_str(), "w");
+        if (!out) {
+            cerr << out_name << " : " << strerror(errno) << endl;
+            return(-1);
+        }
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    if (n % 2 == 0 && shape != Shape::INCOMPLETE)
+        n++;                      // every inner node gets two children.
+
+    mt19937_64 rng(seed);
+    switch (shape) {
+    case Shape::BALANCED:
+        for (long long i = 1; i <= n; ++i)
+            balancedLine(out, i, n);
+        break;
+    case Shape::LEFT_CHAIN:
+        writeChain(out, n, true);
+        break;
+    case Shape::RIGHT_CHAIN:
+        writeChain(out, n, false);
+        break;
+    case Shape::SHUFFLED: {
+        vector<int> order(n - 1);
+        for (long long i = 0; i < n - 1; ++i)
+            order[i] = i + 2;
+        shuffle(order.begin(), order.end(), rng);
+        balancedLine(out, 1, n);
+        for (long long i = 0; i < n - 1; ++i)
+            balancedLine(out, order[i], n);
+        break;
+    }
+    case Shape::DUP_FOREST:
+        writeDupForest(out, n);
+        break;
+    case Shape::INCOMPLETE:
+        writeIncomplete(out, n, rng);
+        break;
+    }
+
+    if (fclose(out) != 0) {
+        cerr << "write error : " << strerror(errno) << endl;
+        return(-1);
+    }
+    return(0);
+}
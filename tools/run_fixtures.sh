@@ -0,0 +1,31 @@
+#!/bin/sh
+# -*- sh -*-
+#
+# Fixture check, run by "make check".
+#   run_fixtures.sh <decode_tree>
+# Every test_*/ with an args file is decoded with those arguments from the
+# top of the tree, its stdout and stderr have to match expected.out and
+# expected.err. Directories with just a data.txt are inputs to try by hand.
+
+DECODE=${1:?decode_tree binary}
+OUT=${TMPDIR:-/tmp}/fixture.$$
+fail=0
+
+for dir in test_*/; do
+    dir=${dir%/}
+    [ -f "$dir/args" ] || continue
+
+    "$DECODE" $(cat "$dir/args") > "$OUT.out" 2> "$OUT.err"
+    if cmp -s "$OUT.out" "$dir/expected.out" &&
+       cmp -s "$OUT.err" "$dir/expected.err"; then
+        echo "ok   $dir"
+    else
+        echo "FAIL $dir"
+        diff "$dir/expected.out" "$OUT.out"
+        diff "$dir/expected.err" "$OUT.err"
+        fail=1
+    fi
+done
+
+rm -f "$OUT.out" "$OUT.err"
+exit $fail
@@ -0,0 +1,191 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+#ifndef TRAVERSE_H
+#define TRAVERSE_H
+
+/**
+ * Iterative traversals over any node type with left_/right_ pointers.
+ * No recursion, so a chain shaped tree of any depth is fine, and no
+ * allocation per node: pending nodes sit in one vector that is reserved
+ * up front (hint) and only ever grows geometrically.
+ * Usage:
+ *   InOrderIter<node_t> it(root);
+ *   for (const node_t *t; (t = it.next()) != NULL; ) ...
+ */
+
+/**
+ * root, left subtree, right subtree. Right is pushed before left so a
+ * left leaning chain keeps the stack at one entry.
+ */
+template <typename N>
+class PreOrderIter
+{
+public:
+    explicit PreOrderIter(const N *root, size_t hint = 64)
+    {
+        stack_.reserve(hint);
+        if (root)
+            stack_.push_back(root);
+    }
+
+    const N *next()
+    {
+        if (stack_.empty())
+            return NULL;
+
+        const N *t = stack_.back();
+        stack_.pop_back();
+        if (t->right_)
+            stack_.push_back(t->right_);
+        if (t->left_)
+            stack_.push_back(t->left_);
+        return t;
+    }
+
+private:
+    vector<const N *> stack_;
+};
+
+/**
+ * left subtree, root, right subtree (what printDFS() prints).
+ */
+template <typename N>
+class InOrderIter
+{
+public:
+    explicit InOrderIter(const N *root, size_t hint = 64)
+        : cur_(root)
+    {
+        stack_.reserve(hint);
+    }
+
+    const N *next()
+    {
+        while (cur_) {
+            stack_.push_back(cur_);
+            cur_ = cur_->left_;
+        }
+
+        if (stack_.empty())
+            return NULL;
+
+        const N *t = stack_.back();
+        stack_.pop_back();
+        cur_ = t->right_;
+        return t;
+    }
+
+private:
+    vector<const N *> stack_;
+    const N *cur_;
+};
+
+/**
+ * left subtree, right subtree, root. A node is handed out once the
+ * last one returned was its right child (or it has none).
+ */
+template <typename N>
+class PostOrderIter
+{
+public:
+    explicit PostOrderIter(const N *root, size_t hint = 64)
+        : cur_(root),
+          last_(NULL)
+    {
+        stack_.reserve(hint);
+    }
+
+    const N *next()
+    {
+        for (;;) {
+            while (cur_) {
+                stack_.push_back(cur_);
+                cur_ = cur_->left_;
+            }
+
+            if (stack_.empty())
+                return NULL;
+
+            const N *t = stack_.back();
+            if (t->right_ && last_ != t->right_) {
+                cur_ = t->right_;
+                continue;
+            }
+
+            stack_.pop_back();
+            last_ = t;
+            return t;
+        }
+    }
+
+private:
+    vector<const N *> stack_;
+    const N *cur_;
+    const N *last_;
+};
+
+/**
+ * Level by level, left to right (what printBFS() prints).
+ * A ring buffer instead of std::queue, it holds at most the widest two
+ * levels and never gives memory back while the traversal runs.
+ */
+template <typename N>
+class LevelOrderIter
+{
+public:
+    explicit LevelOrderIter(const N *root, size_t hint = 64)
+        : head_(0),
+          count_(0)
+    {
+        size_t cap = 16;
+        while (cap < hint)
+            cap <<= 1;
+        ring_.resize(cap);
+        if (root)
+            push(root);
+    }
+
+    const N *next()
+    {
+        if (count_ == 0)
+            return NULL;
+
+        const N *t = ring_[head_];
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        count_--;
+        if (t->left_)
+            push(t->left_);
+        if (t->right_)
+            push(t->right_);
+        return t;
+    }
+
+private:
+    void push(const N *t)
+    {
+        if (count_ == ring_.size())
+            grow();
+        ring_[(head_ + count_) & (ring_.size() - 1)] = t;
+        count_++;
+    }
+
+    void grow()
+    {
+        // unwrap into a twice as big ring, head goes back to 0.
+        vector<const N *> bigger(ring_.size() * 2);
+        for (size_t i = 0; i < count_; ++i)
+            bigger[i] = ring_[(head_ + i) & (ring_.size() - 1)];
+        ring_.swap(bigger);
+        head_ = 0;
+    }
+
+    vector<const N *> ring_;      /// size is a power of 2.
+    size_t head_;
+    size_t count_;
+};
+
+#endif
@@ -0,0 +1,128 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:tree_publish.cc
+ * Epoch based publishing of decoded trees, see tree_publish.h.
+ * A reader announces the epoch it started in before it loads the tree
+ * pointer. A writer swaps the pointer, then moves the epoch on, so a
+ * reader announcing a later epoch can only have loaded the new tree.
+ * The replaced tree goes when no slot holds its epoch or an older one.
+ * All atomics are sequentially consistent, the announce/load and the
+ * swap/check pairs rely on it.
+ */
+
+#include "build_tree.h"
+#include "tree_publish.h"
+#include <functional>
+#include <thread>
+
+using namespace std;
+
+const uint64_t readerIdle = 0;   /// slot is free, epochs start at 1
+
+TreePublisher::TreePublisher(size_t max_readers)
+    : current_(NULL),
+      epoch_(1),
+      slots_(new reader_slot_t[max_readers ? max_readers : 1]),
+      slotCount_(max_readers ? max_readers : 1)
+{
+    for (size_t i = 0; i < slotCount_; ++i)
+        slots_[i].epoch_.store(readerIdle);
+}
+
+TreePublisher::~TreePublisher()
+{
+    delete current_.load();
+    for (size_t i = 0; i < retired_.size(); ++i)
+        delete retired_[i].tree_;
+}
+
+void
+TreePublisher::publish(unique_ptr<BuildTree> tree)
+{
+    lock_guard<mutex> lock(writeLock_);
+    BuildTree *old = current_.exchange(tree.release());
+    uint64_t e = epoch_.fetch_add(1);
+    if (old) {
+        retired_t r = { old, e };
+        retired_.push_back(r);
+    }
+    reclaimLocked();
+}
+
+size_t
+TreePublisher::reclaim()
+{
+    lock_guard<mutex> lock(writeLock_);
+    return reclaimLocked();
+}
+
+size_t
+TreePublisher::reclaimLocked()
+{
+    if (retired_.empty())
+        return(0);
+
+    uint64_t oldest = epoch_.load();
+    for (size_t i = 0; i < slotCount_; ++i) {
+        uint64_t e = slots_[i].epoch_.load();
+        if (e != readerIdle && e < oldest)
+            oldest = e;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_.size(); ++i) {
+        if (retired_[i].epoch_ < oldest)
+            delete retired_[i].tree_;
+        else
+            retired_[kept++] = retired_[i];
+    }
+    retired_.resize(kept);
+    return kept;
+}
+
+TreePublisher::Reader::Reader(TreePublisher& pub)
+    : pub_(pub),
+      slot_(0),
+      tree_(NULL)
+{
+    // any idle slot will do, start somewhere per thread to spread out.
+    size_t start = hash<thread::id>()(this_thread::get_id());
+    for (size_t i = 0; ; ++i) {
+        slot_ = (start + i) % pub_.slotCount_;
+        uint64_t idle = readerIdle;
+        uint64_t e = pub_.epoch_.load();
+        if (pub_.slots_[slot_].epoch_.compare_exchange_strong(idle, e))
+            break;
+        if ((i + 1) % pub_.slotCount_ == 0)
+            this_thread::yield();
+    }
+    tree_ = pub_.current_.load();
+}
+
+TreePublisher::Reader::~Reader()
+{
+    pub_.slots_[slot_].epoch_.store(readerIdle);
+}
@@ -0,0 +1,94 @@
+// -*- C++ -*-
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+#ifndef TREE_PUBLISH_H
+#define TREE_PUBLISH_H
+
+class BuildTree;
+
+/**
+ * Hands finished trees from a decoding thread to any number of reader
+ * threads. Readers never lock and never see a tree being built: a tree
+ * is published once decodeFile() is done and is immutable from then on,
+ * the next one decodes on the side and replaces it with one pointer swap.
+ * Replaced trees are freed once no reader that could still see them is
+ * left (epoch based reclamation).
+ *   writer:  unique_ptr<BuildTree> bt(new BuildTree(f));
+ *            bt->decodeFile(); bt->prepareQuery();
+ *            pub.publish(move(bt));
+ *   reader:  TreePublisher::Reader r(pub);
+ *            if (r.tree()) r.tree()->printBFS(sink);
+ * Readers use the const interface only (traversals into their own sink,
+ * query(), stats()), which writes nothing shared: lookups do not count
+ * probes and printers add their time atomically. Do prepareQuery()
+ * before publishing. make bench_publish runs readers against a writer.
+ */
+class TreePublisher
+{
+public:
+    explicit TreePublisher(size_t max_readers = 64);
+    virtual ~TreePublisher();        /// no Reader may be left.
+
+    /// Make tree the current one, takes ownership. Also reclaims.
+    void publish(unique_ptr<BuildTree> tree);
+    /// Free replaced trees no reader can see any more, returns how many
+    /// are still waiting.
+    size_t reclaim();
+    uint64_t version() const { return epoch_.load(); }
+
+    /**
+     * Pins the current tree for its lifetime, keep it short lived and
+     * on one thread. Blocks (yields) only if max_readers are pinned.
+     */
+    class Reader
+    {
+    public:
+        explicit Reader(TreePublisher& pub);
+        ~Reader();
+
+        const BuildTree *tree() const { return tree_; }
+
+    private:
+        Reader(const Reader&);                /// no copies.
+        Reader& operator=(const Reader&);
+
+        TreePublisher& pub_;
+        size_t slot_;
+        const BuildTree *tree_;
+    };
+
+private:
+    TreePublisher(const TreePublisher&);      /// no copies.
+    TreePublisher& operator=(const TreePublisher&);
+
+    size_t reclaimLocked();
+
+    typedef struct retired
+    {
+        BuildTree *tree_;
+        uint64_t epoch_;          /// last epoch it was current in
+    } retired_t;
+
+    /// Padded to a cache line, readers write them all the time.
+    typedef struct reader_slot
+    {
+        atomic<uint64_t> epoch_;  /// readerIdle or the epoch pinned at
+        char pad_[64 - sizeof(atomic<uint64_t>)];
+    } reader_slot_t;
+
+    atomic<BuildTree *> current_;
+    atomic<uint64_t> epoch_;
+    unique_ptr<reader_slot_t[]> slots_;
+    size_t slotCount_;
+    mutex writeLock_;             /// publish()/reclaim(), writers only
+    vector<retired_t> retired_;
+};
+
+#endif
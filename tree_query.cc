@@ -0,0 +1,225 @@
+// -*- C++ -*-
+
+/**
+ * Copyright (c) 2014 Powell Molleti
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file:tree_query.cc
+ * Preorder numbering, parent/depth/subtree size arrays and an id index
+ * over a decoded tree, see tree_query.h.
+ * LCA is range minimum over the preorder: for a < b the shallowest node
+ * in (a, b] is a child of the lca on the way to b, so its parent is the
+ * answer. Same idea as the Euler tour + sparse table, with n entries per
+ * level instead of 2n.
+ */
+
+#include "build_tree.h"
+#include "tree_query.h"
+#include <thread>
+
+using namespace std;
+
+TreeQuery::TreeQuery()
+{
+}
+
+TreeQuery::~TreeQuery()
+{
+}
+
+void
+TreeQuery::clear()
+{
+    nodes_.clear();
+    parent_.clear();
+    depth_.clear();
+    size_.clear();
+    ids_.clear();
+    table_.clear();
+}
+
+/**
+ * One iterative preorder pass hands out the numbers, parents always come
+ * before their children so a reverse sweep adds up the subtree sizes.
+ */
+int
+TreeQuery::build(const node_t *root)
+{
+    clear();
+    if (!root)
+        return(-1);
+
+    typedef struct pending
+    {
+        const node_t *n_;
+        uint32_t parent_;
+    } pending_t;
+
+    vector<pending_t> stack;
+    stack.reserve(64);
+    pending_t top = { root, queryNone };
+    stack.push_back(top);
+    while (!stack.empty()) {
+        pending_t p = stack.back();
+        stack.pop_back();
+
+        uint32_t i = nodes_.size();
+        nodes_.push_back(p.n_);
+        parent_.push_back(p.parent_);
+        depth_.push_back(p.parent_ == queryNone ? 0 : depth_[p.parent_] + 1);
+        ids_.insert(p.n_->id_)->push_back(i);
+
+        // right first so the left subtree gets the lower numbers.
+        if (p.n_->right_) {
+            pending_t r = { p.n_->right_, i };
+            stack.push_back(r);
+        }
+        if (p.n_->left_) {
+            pending_t l = { p.n_->left_, i };
+            stack.push_back(l);
+        }
+    }
+
+    size_.assign(nodes_.size(), 1);
+    for (size_t i = nodes_.size() - 1; i > 0; --i)
+        size_[parent_[i]] += size_[i];
+    return(0);
+}
+
+int
+TreeQuery::id(uint32_t i) const
+{
+    return nodes_[i]->id_;
+}
+
+uint32_t
+TreeQuery::find(int id) const
+{
+    const FlatIndex<uint32_t>::slot *s = ids_.lookup(id);
+    return (s ? s->at(0) : queryNone);
+}
+
+size_t
+TreeQuery::findAll(int id, vector<uint32_t>& out) const
+{
+    out.clear();
+    const FlatIndex<uint32_t>::slot *s = ids_.lookup(id);
+    if (!s)
+        return(0);
+
+    for (unsigned int k = 0; k < s->size(); ++k)
+        out.push_back(s->at(k));
+    return out.size();
+}
+
+size_t
+TreeQuery::ancestors(uint32_t i, vector<uint32_t>& out) const
+{
+    out.clear();
+    out.reserve(depth_[i]);
+    for (uint32_t a = parent_[i]; a != queryNone; a = parent_[a])
+        out.push_back(a);
+    return out.size();
+}
+
+int
+TreeQuery::prepareLca()
+{
+    table_.clear();
+    size_t n = nodes_.size();
+    if (n == 0)
+        return(-1);
+
+    table_.push_back(vector<uint32_t>(n));
+    for (size_t i = 0; i < n; ++i)
+        table_[0][i] = i;
+
+    for (size_t k = 1; ((size_t)1 << k) <= n; ++k) {
+        size_t half = (size_t)1 << (k - 1);
+        const vector<uint32_t>& prev = table_[k - 1];
+        vector<uint32_t> level(n - (half << 1) + 1);
+        for (size_t i = 0; i < level.size(); ++i) {
+            uint32_t x = prev[i], y = prev[i + half];
+            level[i] = (depth_[y] < depth_[x] ? y : x);
+        }
+        table_.push_back(vector<uint32_t>());
+        table_.back().swap(level);
+    }
+    return(0);
+}
+
+uint32_t
+TreeQuery::lca(uint32_t a, uint32_t b) const
+{
+    if (a == b)
+        return a;
+    if (a > b)
+        swap(a, b);
+
+    // shallowest in [a + 1, b], two overlapping power of 2 windows.
+    uint32_t lo = a + 1;
+    unsigned int k = 31 - __builtin_clz(b - lo + 1);
+    uint32_t x = table_[k][lo];
+    uint32_t y = table_[k][b - (1u << k) + 1];
+    return parent_[depth_[y] < depth_[x] ? y : x];
+}
+
+void
+TreeQuery::lcaBatch(const vector<lca_query_t>& queries,
+                    vector<lca_answer_t>& answers,
+                    unsigned int threads) const
+{
+    answers.resize(queries.size());
+    if (threads == 0)
+        threads = 1;
+
+    auto work = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t a = find(queries[i].a_);
+            uint32_t b = find(queries[i].b_);
+            if (a == queryNone || b == queryNone) {
+                answers[i].lca_ = queryNone;
+                answers[i].dist_ = queryNone;
+                continue;
+            }
+            uint32_t l = lca(a, b);
+            answers[i].lca_ = l;
+            answers[i].dist_ = depth_[a] + depth_[b] - 2 * depth_[l];
+        }
+    };
+
+    // below this a thread costs more than it saves.
+    const size_t minPerThread = 4096;
+    size_t per = (queries.size() + threads - 1) / threads;
+    if (per < minPerThread)
+        per = minPerThread;
+
+    vector<thread> pool;
+    for (size_t begin = per; begin < queries.size(); begin += per) {
+        size_t end = (begin + per < queries.size() ? begin + per
+                                                   : queries.size());
+        pool.push_back(thread(work, begin, end));
+    }
+    work(0, (per < queries.size() ? per : queries.size()));
+    for (size_t t = 0; t < pool.size(); ++t)
+        pool[t].join();
+}
@@ -0,0 +1,97 @@
+// -*- C++ -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "flat_index.h"
+using namespace std;
+
+#ifndef TREE_QUERY_H
+#define TREE_QUERY_H
+
+struct node;
+
+const uint32_t queryNone = 0xffffffff;      /// no such node
+
+/// One lowest common ancestor question by node id, see lcaBatch().
+typedef struct lca_query
+{
+    int a_;
+    int b_;
+} lca_query_t;
+
+typedef struct lca_answer
+{
+    uint32_t lca_;                /// queryNone if an id is unknown
+    uint32_t dist_;               /// edges on the path from a_ to b_
+} lca_answer_t;
+
+/**
+ * Read only queries over a decoded tree. Nodes are addressed by their
+ * preorder number (root is 0), a node's subtree is then the interval
+ * [i, i + subtreeSize(i)) which makes ancestor and subtree tests O(1).
+ * The id index keeps every node of an id in preorder, so -d trees with
+ * repeated ids work, find() returns the first one.
+ * Holds pointers into the tree, rebuild after the tree changes.
+ */
+class TreeQuery
+{
+public:
+    TreeQuery();
+    virtual ~TreeQuery();
+
+    int build(const struct node *root);   /// 0, or -1 if root is NULL
+    void clear();
+    bool isBuilt() const { return !nodes_.empty(); }
+    size_t size() const { return nodes_.size(); }
+
+    uint32_t find(int id) const;
+    /// All nodes carrying id in preorder, returns how many.
+    size_t findAll(int id, vector<uint32_t>& out) const;
+
+    const struct node *node(uint32_t i) const { return nodes_[i]; }
+    int id(uint32_t i) const;
+    uint32_t parent(uint32_t i) const { return parent_[i]; }
+    uint32_t depth(uint32_t i) const { return depth_[i]; }   /// root is 0
+    uint32_t subtreeSize(uint32_t i) const { return size_[i]; }
+
+    /// a == d counts, a node is its own ancestor.
+    bool isAncestor(uint32_t a, uint32_t d) const
+    {
+        return (a <= d && d - a < size_[a]);
+    }
+
+    /// Parent first, root last, returns how many.
+    size_t ancestors(uint32_t i, vector<uint32_t>& out) const;
+
+    /// Sparse table for lca(), n log n entries, call once after build().
+    int prepareLca();
+    bool lcaReady() const { return !table_.empty(); }
+    uint32_t lca(uint32_t a, uint32_t b) const;
+    uint32_t distance(uint32_t a, uint32_t b) const
+    {
+        return depth_[a] + depth_[b] - 2 * depth_[lca(a, b)];
+    }
+
+    /**
+     * Answers queries[i] into answers[i], split over threads. Ids are
+     * resolved with find(), so for a repeated id the first one counts.
+     */
+    void lcaBatch(const vector<lca_query_t>& queries,
+                  vector<lca_answer_t>& answers,
+                  unsigned int threads) const;
+
+private:
+    TreeQuery(const TreeQuery&);            /// no copies.
+    TreeQuery& operator=(const TreeQuery&);
+
+    vector<const struct node *> nodes_;
+    vector<uint32_t> parent_;
+    vector<uint32_t> depth_;
+    vector<uint32_t> size_;       /// subtree node count, incl. itself
+    FlatIndex<uint32_t> ids_;
+    /// table_[k][i] is the shallowest node in [i, i + 2^k).
+    vector<vector<uint32_t> > table_;
+};
+
+#endif